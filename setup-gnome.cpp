@@ -24,14 +24,16 @@
 #include <gio/gio.h>
 
 #include "touchpad-control.h"
+#include "trigger-stats.h"
 
 using std::cerr;
 using std::endl;
 
 static int lockfile;
 static GSettings *touchpad_settings = NULL;
-static GDBusProxy *session_manager_properties = NULL;
-static GDBusProxy *display_config_properties = NULL;
+static GDBusConnection *session_bus = NULL;
+static guint session_manager_properties_subscription = 0;
+static guint display_config_properties_subscription = 0;
 
 static void send_events_handler(GSettings *settings, const char* key, __attribute__((unused)) gpointer user_data) {
     const gchar *send_events_string = g_settings_get_string(settings, key);
@@ -50,8 +52,24 @@ static void send_events_handler(GSettings *settings, const char* key, __attribut
     }
 }
 
-static void  session_manager_properties_changed_handler(__attribute__((unused)) GDBusProxy *proxy, GVariant *changed_properties, __attribute__((unused)) GStrv invalidated_properties, gpointer user_data) {
-    if (g_variant_is_of_type(changed_properties, G_VARIANT_TYPE_VARDICT)) {
+static void send_events_changed_handler(GSettings *settings, const char* key, gpointer user_data) {
+    gint64 start_time = g_get_monotonic_time();
+    send_events_handler(settings, key, user_data);
+    record_trigger("gsettings send-events", start_time);
+}
+
+// "GVariant *parameters" are the "(sa{sv}as)" arguments of a "org.freedesktop.DBus.Properties.PropertiesChanged" signal
+static GVariant *get_changed_properties(GVariant *parameters) {
+    if (!g_variant_is_of_type(parameters, G_VARIANT_TYPE("(sa{sv}as)"))) {
+        return NULL;
+    }
+    return g_variant_get_child_value(parameters, 1);
+}
+
+static void session_manager_properties_changed_handler(__attribute__((unused)) GDBusConnection *connection, __attribute__((unused)) const gchar *sender_name, __attribute__((unused)) const gchar *object_path, __attribute__((unused)) const gchar *interface_name, __attribute__((unused)) const gchar *signal_name, GVariant *parameters, gpointer user_data) {
+    gint64 start_time = g_get_monotonic_time();
+    GVariant *changed_properties = get_changed_properties(parameters);
+    if (changed_properties) {
         GVariantDict changed_properties_dict;
         gboolean sessionIsActive;
 
@@ -61,32 +79,45 @@ static void  session_manager_properties_changed_handler(__attribute__((unused))
                 if (flock(lockfile, LOCK_EX)) {
                     cerr << "properties_changed_handler(...): flock(...) failed." << endl;
                 }
+                // another session might have changed the touchpad state in the meantime
+                reset_touchpad_states();
                 send_events_handler((GSettings *)user_data, "send-events", NULL);
             }
             else {
-                if (set_touchpad_state(1)) {
-                    cerr << "properties_changed_handler(...): set_touchpad_state(...) failed." << endl;
+                if (restore_touchpad_state()) {
+                    cerr << "properties_changed_handler(...): restore_touchpad_state(...) failed." << endl;
                 }
                 if (flock(lockfile, LOCK_UN)) {
                     cerr << "properties_changed_handler(...): flock(...) failed." << endl;
                 }
+                reset_touchpad_states();
             }
         }
+        g_variant_dict_clear(&changed_properties_dict);
+        g_variant_unref(changed_properties);
     }
+    record_trigger("org.gnome.SessionManager", start_time);
 }
 
-static void  display_config_properties_changed_handler(__attribute__((unused)) GDBusProxy *proxy, GVariant *changed_properties, __attribute__((unused)) GStrv invalidated_properties, gpointer user_data) {
-    if (g_variant_is_of_type(changed_properties, G_VARIANT_TYPE_VARDICT)) {
+static void display_config_properties_changed_handler(__attribute__((unused)) GDBusConnection *connection, __attribute__((unused)) const gchar *sender_name, __attribute__((unused)) const gchar *object_path, __attribute__((unused)) const gchar *interface_name, __attribute__((unused)) const gchar *signal_name, GVariant *parameters, gpointer user_data) {
+    gint64 start_time = g_get_monotonic_time();
+    GVariant *changed_properties = get_changed_properties(parameters);
+    if (changed_properties) {
         GVariantDict changed_properties_dict;
         gint32 powerSaveMode;
 
         g_variant_dict_init (&changed_properties_dict, changed_properties);
         if (g_variant_dict_lookup (&changed_properties_dict, "PowerSaveMode", "i", &powerSaveMode)) {
             if (powerSaveMode == 0) {
+                // the touchpad firmware might have been reset while sleeping
+                reset_touchpad_states();
                 send_events_handler((GSettings *)user_data, "send-events", NULL);
             }
         }
+        g_variant_dict_clear(&changed_properties_dict);
+        g_variant_unref(changed_properties);
     }
+    record_trigger("org.gnome.Mutter.DisplayConfig", start_time);
 }
 
 int setup_gnome(int lockfile_arg) {
@@ -100,40 +131,46 @@ int setup_gnome(int lockfile_arg) {
     }
     
     // sync on config change
-    if (g_signal_connect(touchpad_settings, "changed::send-events", G_CALLBACK(send_events_handler), NULL) < 1) {
+    if (g_signal_connect(touchpad_settings, "changed::send-events", G_CALLBACK(send_events_changed_handler), NULL) < 1) {
         cerr << "setup_gnome(...): g_signal_connect(...) failed." << endl;
         return EXIT_FAILURE;
     }
     
-    // sync on xsession change
-    session_manager_properties = g_dbus_proxy_new_for_bus_sync(G_BUS_TYPE_SESSION,
-                                                                           G_DBUS_PROXY_FLAGS_NONE, NULL,
-                                                                           "org.gnome.SessionManager",
-                                                                           "/org/gnome/SessionManager",
-                                                                           "org.gnome.SessionManager",
-                                                                           NULL, NULL);
-    if (session_manager_properties == NULL) {
-        cerr << "setup_gnome(...): g_dbus_proxy_new_for_bus_sync(...) failed." << endl;
+    // plain signal subscriptions instead of proxies: no properties get loaded and cached, and with the arg0 filter on the
+    // interface name the bus only forwards property changes of the interfaces of interest
+    session_bus = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, NULL);
+    if (session_bus == NULL) {
+        cerr << "setup_gnome(...): g_bus_get_sync(...) failed." << endl;
         return EXIT_FAILURE;
     }
-    if (g_signal_connect(session_manager_properties, "g-properties-changed", G_CALLBACK(session_manager_properties_changed_handler), touchpad_settings) < 1) {
-        cerr << "setup_gnome(...): g_signal_connect(...) failed." << endl;
+    
+    // sync on xsession change
+    session_manager_properties_subscription = g_dbus_connection_signal_subscribe(session_bus,
+                                                                                 "org.gnome.SessionManager",
+                                                                                 "org.freedesktop.DBus.Properties",
+                                                                                 "PropertiesChanged",
+                                                                                 "/org/gnome/SessionManager",
+                                                                                 "org.gnome.SessionManager",
+                                                                                 G_DBUS_SIGNAL_FLAGS_NONE,
+                                                                                 session_manager_properties_changed_handler,
+                                                                                 touchpad_settings, NULL);
+    if (session_manager_properties_subscription == 0) {
+        cerr << "setup_gnome(...): g_dbus_connection_signal_subscribe(...) failed." << endl;
         return EXIT_FAILURE;
     }
     
     // sync on wakeup
-    display_config_properties = g_dbus_proxy_new_for_bus_sync(G_BUS_TYPE_SESSION,
-                                                                          G_DBUS_PROXY_FLAGS_NONE, NULL,
-                                                                          "org.gnome.Mutter.DisplayConfig",
-                                                                          "/org/gnome/Mutter/DisplayConfig",
-                                                                          "org.gnome.Mutter.DisplayConfig",
-                                                                          NULL, NULL);
-    if (display_config_properties == NULL) {
-        cerr << "setup_gnome(...): g_dbus_proxy_new_for_bus_sync(...) failed." << endl;
-        return EXIT_FAILURE;
-    }
-    if (g_signal_connect(display_config_properties, "g-properties-changed", G_CALLBACK(display_config_properties_changed_handler), touchpad_settings) < 1) {
-        cerr << "setup_gnome(...): g_signal_connect(...) failed." << endl;
+    display_config_properties_subscription = g_dbus_connection_signal_subscribe(session_bus,
+                                                                                "org.gnome.Mutter.DisplayConfig",
+                                                                                "org.freedesktop.DBus.Properties",
+                                                                                "PropertiesChanged",
+                                                                                "/org/gnome/Mutter/DisplayConfig",
+                                                                                "org.gnome.Mutter.DisplayConfig",
+                                                                                G_DBUS_SIGNAL_FLAGS_NONE,
+                                                                                display_config_properties_changed_handler,
+                                                                                touchpad_settings, NULL);
+    if (display_config_properties_subscription == 0) {
+        cerr << "setup_gnome(...): g_dbus_connection_signal_subscribe(...) failed." << endl;
         return EXIT_FAILURE;
     }
     
@@ -145,7 +182,14 @@ int setup_gnome(int lockfile_arg) {
 }
 
 void clean_gnome() {
-    g_clear_object(&session_manager_properties);
-    g_clear_object(&display_config_properties);
+    if (session_manager_properties_subscription) {
+        g_dbus_connection_signal_unsubscribe(session_bus, session_manager_properties_subscription);
+        session_manager_properties_subscription = 0;
+    }
+    if (display_config_properties_subscription) {
+        g_dbus_connection_signal_unsubscribe(session_bus, display_config_properties_subscription);
+        display_config_properties_subscription = 0;
+    }
+    g_clear_object(&session_bus);
     g_clear_object(&touchpad_settings);
 }
@@ -24,17 +24,37 @@
 #include <gio/gio.h>
 
 #include "touchpad-control.h"
+#include "trigger-stats.h"
 
 using std::cerr;
 using std::endl;
 
+// upper bound for synchronous calls to kded, they block the glib mainloop and with it the handling of all other events
+#define DBUS_CALL_TIMEOUT_MILLISECONDS 1000
+
 int lockfile;
 gboolean isMousePluggedInPrev;
 gboolean isEnabledSave;
-GDBusProxy *kded_modules_touchpad = NULL;
-GDBusProxy *solid_power_management = NULL;
+static GDBusConnection *session_bus = NULL;
+static const char *kded_modules_touchpad_name = NULL;
+static const char *kded_modules_touchpad_path = NULL;
+static guint kded_modules_touchpad_subscriptions[2] = {0, 0};
+static guint solid_power_management_subscriptions[2] = {0, 0};
+
+// calls a method without arguments returning "(b)" on the kded touchpad module, returns NULL on error
+static GVariant *kded_modules_touchpad_call_sync(const char *method) {
+    return g_dbus_connection_call_sync(session_bus,
+                                       kded_modules_touchpad_name,
+                                       kded_modules_touchpad_path,
+                                       "org.kde.touchpad",
+                                       method,
+                                       NULL, G_VARIANT_TYPE("(b)"),
+                                       G_DBUS_CALL_FLAGS_NONE,
+                                       DBUS_CALL_TIMEOUT_MILLISECONDS, NULL, NULL);
+}
 
-static void kded_modules_touchpad_handler(GDBusProxy *proxy, __attribute__((unused)) char *sender_name, char *signal_name, GVariant *parameters, __attribute__((unused)) gpointer user_data) {
+static void kded_modules_touchpad_handler(__attribute__((unused)) GDBusConnection *connection, __attribute__((unused)) const gchar *sender_name, __attribute__((unused)) const gchar *object_path, __attribute__((unused)) const gchar *interface_name, const gchar *signal_name, GVariant *parameters, __attribute__((unused)) gpointer user_data) {
+    gint64 start_time = g_get_monotonic_time();
     if (!strcmp("enabledChanged", signal_name) && g_variant_is_of_type(parameters, (const GVariantType *)"(b)") && g_variant_n_children(parameters)) {
         GVariant *enabledChanged = g_variant_get_child_value(parameters, 0);
         
@@ -52,21 +72,23 @@ static void kded_modules_touchpad_handler(GDBusProxy *proxy, __attribute__((unus
         g_variant_unref(enabledChanged);
     }
     else if (!strcmp("mousePluggedInChanged", signal_name) && g_variant_is_of_type(parameters, (const GVariantType *)"(b)") && g_variant_n_children(parameters)) {
-        GVariant *isMousePluggedInParam = g_dbus_proxy_call_sync(proxy, "isMousePluggedIn", NULL, G_DBUS_CALL_FLAGS_NONE, G_MAXINT, NULL, NULL);
+        GVariant *isMousePluggedInParam = kded_modules_touchpad_call_sync("isMousePluggedIn");
         if (isMousePluggedInParam != NULL && g_variant_is_of_type(isMousePluggedInParam, (const GVariantType *)"(b)") && g_variant_n_children(isMousePluggedInParam)) {
             GVariant *isMousePluggedIn = g_variant_get_child_value(isMousePluggedInParam, 0);
             if (isMousePluggedInPrev && !g_variant_get_boolean(isMousePluggedIn)) {
-                if (set_touchpad_state(1)) {
-                    cerr << "kded_modules_touchpad_handler(...): set_touchpad_state(...) failed." << endl;
+                if (restore_touchpad_state()) {
+                    cerr << "kded_modules_touchpad_handler(...): restore_touchpad_state(...) failed." << endl;
                 }
                 if (flock(lockfile, LOCK_UN)) {
                     cerr << "kded_modules_touchpad_handler(...): flock(...) failed." << endl;
                 }
+                reset_touchpad_states();
             }
             else if (!isMousePluggedInPrev && g_variant_get_boolean(isMousePluggedIn)) {
                 if (flock(lockfile, LOCK_EX)) {
                     cerr << "kded_modules_touchpad_handler(...): flock(...) failed." << endl;
                 }
+                reset_touchpad_states();
                 if (set_touchpad_state(isEnabledSave)) {
                     cerr << "kded_modules_touchpad_handler(...): set_touchpad_state(...) failed." << endl;
                 }
@@ -76,32 +98,38 @@ static void kded_modules_touchpad_handler(GDBusProxy *proxy, __attribute__((unus
             g_variant_unref(isMousePluggedInParam);
         }
         else {
-            cerr << "kded_modules_touchpad_handler(...): g_dbus_proxy_call_sync(...) failed." << endl;
+            cerr << "kded_modules_touchpad_handler(...): g_dbus_connection_call_sync(...) failed." << endl;
         }
     }
+    record_trigger("org.kde.touchpad", start_time);
 }
 
-static void solid_power_management_handler(__attribute__((unused)) GDBusProxy *proxy, __attribute__((unused)) char *sender_name, char *signal_name, __attribute__((unused)) GVariant *parameters, __attribute__((unused)) gpointer user_data) {
+static void solid_power_management_handler(__attribute__((unused)) GDBusConnection *connection, __attribute__((unused)) const gchar *sender_name, __attribute__((unused)) const gchar *object_path, __attribute__((unused)) const gchar *interface_name, const gchar *signal_name, __attribute__((unused)) GVariant *parameters, __attribute__((unused)) gpointer user_data) {
+    gint64 start_time = g_get_monotonic_time();
     if (!strcmp("aboutToSuspend", signal_name)) {
-        if (set_touchpad_state(1)) {
-            cerr << "kded_modules_touchpad_handler(...): set_touchpad_state(...) failed." << endl;
+        if (restore_touchpad_state()) {
+            cerr << "kded_modules_touchpad_handler(...): restore_touchpad_state(...) failed." << endl;
         }
         if (flock(lockfile, LOCK_UN)) {
             cerr << "kded_modules_touchpad_handler(...): flock(...) failed." << endl;
         }
+        reset_touchpad_states();
     }
     else if (!strcmp("resumingFromSuspend", signal_name)) {
         if (flock(lockfile, LOCK_EX)) {
             cerr << "kded_modules_touchpad_handler(...): flock(...) failed." << endl;
         }
+        // the touchpad firmware might have been reset while sleeping
+        reset_touchpad_states();
         if (set_touchpad_state(isEnabledSave)) {
             cerr << "kded_modules_touchpad_handler(...): set_touchpad_state(...) failed." << endl;
         }
     }
+    record_trigger("org.kde.Solid.PowerManagement", start_time);
 }
 
-static int kded_modules_touchpad_init(GDBusProxy *proxy) {
-    GVariant *isEnabledParam = g_dbus_proxy_call_sync(proxy, "isEnabled", NULL, G_DBUS_CALL_FLAGS_NONE, G_MAXINT, NULL, NULL);
+static int kded_modules_touchpad_init() {
+    GVariant *isEnabledParam = kded_modules_touchpad_call_sync("isEnabled");
     if (isEnabledParam != NULL && g_variant_is_of_type(isEnabledParam, (const GVariantType *)"(b)") && g_variant_n_children(isEnabledParam)) {
         GVariant *isEnabled = g_variant_get_child_value(isEnabledParam, 0);
 
@@ -124,11 +152,11 @@ static int kded_modules_touchpad_init(GDBusProxy *proxy) {
         g_variant_unref(isEnabledParam);
     }
     else {
-        cerr << "kded_modules_touchpad_handler(...): g_dbus_proxy_call_sync(...) failed." << endl;
+        cerr << "kded_modules_touchpad_handler(...): g_dbus_connection_call_sync(...) failed." << endl;
         return EXIT_FAILURE;
     }
 
-    GVariant *isMousePluggedInParam = g_dbus_proxy_call_sync(proxy, "isMousePluggedIn", NULL, G_DBUS_CALL_FLAGS_NONE, G_MAXINT, NULL, NULL);
+    GVariant *isMousePluggedInParam = kded_modules_touchpad_call_sync("isMousePluggedIn");
     if (isMousePluggedInParam != NULL && g_variant_is_of_type(isMousePluggedInParam, (const GVariantType *)"(b)") && g_variant_n_children(isMousePluggedInParam)) {
         GVariant *isMousePluggedIn = g_variant_get_child_value(isMousePluggedInParam, 0);
         
@@ -137,105 +165,86 @@ static int kded_modules_touchpad_init(GDBusProxy *proxy) {
         
         // isMousePluggedInPrev just got init so it holds the current value
         if (!isMousePluggedInPrev) {
-            if (set_touchpad_state(1)) {
-                cerr << "kded_modules_touchpad_handler(...): set_touchpad_state(...) failed." << endl;
+            if (restore_touchpad_state()) {
+                cerr << "kded_modules_touchpad_handler(...): restore_touchpad_state(...) failed." << endl;
                 return EXIT_FAILURE;
             }
             if (flock(lockfile, LOCK_UN)) {
                 cerr << "kded_modules_touchpad_handler(...): flock(...) failed." << endl;
                 return EXIT_FAILURE;
             }
+            reset_touchpad_states();
         }
         
         g_variant_unref(isMousePluggedIn);
         g_variant_unref(isMousePluggedInParam);
     }
     else {
-        cerr << "kded_modules_touchpad_handler(...): g_dbus_proxy_call_sync(...) failed." << endl;
+        cerr << "kded_modules_touchpad_handler(...): g_dbus_connection_call_sync(...) failed." << endl;
         return EXIT_FAILURE;
     }
 
     return EXIT_SUCCESS;
 }
 
+static guint subscribe_signal(const char *sender, const char *interface_name, const char *member, const char *object_path, GDBusSignalCallback callback) {
+    return g_dbus_connection_signal_subscribe(session_bus, sender, interface_name, member, object_path, NULL,
+                                              G_DBUS_SIGNAL_FLAGS_NONE, callback, NULL, NULL);
+}
+
 int setup_kde(int lockfile_arg) {
     lockfile = lockfile_arg;
 
-    kded_modules_touchpad = g_dbus_proxy_new_for_bus_sync(G_BUS_TYPE_SESSION,
-                                                          G_DBUS_PROXY_FLAGS_NONE, NULL,
-                                                          "org.kde.kded6",
-                                                          "/modules/kded_touchpad",
-                                                          "org.kde.touchpad",
-                                                          NULL, NULL);
-    // call a random method to check if object exists
-    GVariant *isMousePluggedInParam = g_dbus_proxy_call_sync(kded_modules_touchpad,
-                                                             "isMousePluggedIn",
-                                                             NULL, G_DBUS_CALL_FLAGS_NONE,
-                                                             G_MAXINT, NULL, NULL);
-    if (isMousePluggedInParam == NULL) {
-        g_object_unref(kded_modules_touchpad);
-        g_variant_unref(isMousePluggedInParam);
-        kded_modules_touchpad = g_dbus_proxy_new_for_bus_sync(G_BUS_TYPE_SESSION,
-                                                              G_DBUS_PROXY_FLAGS_NONE, NULL,
-                                                              "org.kde.kded5",
-                                                              "/modules/kded_touchpad",
-                                                              "org.kde.touchpad",
-                                                              NULL, NULL);
+    // plain signal subscriptions instead of proxies: no properties get loaded and cached, and the bus only forwards the
+    // signals of interest, not e.g. the frequent keyboard activity signals of the kded touchpad module
+    session_bus = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, NULL);
+    if (session_bus == NULL) {
+        cerr << "setup_kde(...): g_bus_get_sync(...) failed." << endl;
+        return EXIT_FAILURE;
+    }
+
+    const char *kded_modules_touchpad_candidates[][2] = {
+        {"org.kde.kded6", "/modules/kded_touchpad"},
+        {"org.kde.kded5", "/modules/kded_touchpad"},
+        {"org.kde.kded5", "/modules/touchpad"},
+    };
+    for (auto candidate : kded_modules_touchpad_candidates) {
+        kded_modules_touchpad_name = candidate[0];
+        kded_modules_touchpad_path = candidate[1];
         // call a random method to check if object exists
-        isMousePluggedInParam = g_dbus_proxy_call_sync(kded_modules_touchpad,
-                                                                 "isMousePluggedIn",
-                                                                 NULL, G_DBUS_CALL_FLAGS_NONE,
-                                                                 G_MAXINT, NULL, NULL);
-        if (isMousePluggedInParam == NULL) {
-            g_object_unref(kded_modules_touchpad);
+        GVariant *isMousePluggedInParam = kded_modules_touchpad_call_sync("isMousePluggedIn");
+        if (isMousePluggedInParam != NULL) {
             g_variant_unref(isMousePluggedInParam);
-            kded_modules_touchpad = g_dbus_proxy_new_for_bus_sync(G_BUS_TYPE_SESSION,
-                                                                  G_DBUS_PROXY_FLAGS_NONE, NULL,
-                                                                  "org.kde.kded5",
-                                                                  "/modules/touchpad",
-                                                                  "org.kde.touchpad",
-                                                                  NULL, NULL);
-            // call a random method to check if object exists
-            isMousePluggedInParam = g_dbus_proxy_call_sync(kded_modules_touchpad,
-                                                                    "isMousePluggedIn",
-                                                                    NULL, G_DBUS_CALL_FLAGS_NONE,
-                                                                    G_MAXINT, NULL, NULL);
-            if (isMousePluggedInParam == NULL) {
-                g_clear_object(&kded_modules_touchpad);
-                g_variant_unref(isMousePluggedInParam);
-                cerr << "setup_kde(...): g_dbus_proxy_new_for_bus_sync(...) failed." << endl;
-                return EXIT_FAILURE;
-            }
+            break;
         }
+        kded_modules_touchpad_name = NULL;
+        kded_modules_touchpad_path = NULL;
+    }
+    if (kded_modules_touchpad_name == NULL) {
+        cerr << "setup_kde(...): g_dbus_connection_call_sync(...) failed." << endl;
+        clean_kde();
+        return EXIT_FAILURE;
     }
-    g_variant_unref(isMousePluggedInParam);
 
-    if (g_signal_connect(kded_modules_touchpad, "g-signal", G_CALLBACK(kded_modules_touchpad_handler), NULL) < 1) {
-        cerr << "setup_kde(...): g_signal_connect(...) failed." << endl;
-        g_clear_object(&kded_modules_touchpad);
+    kded_modules_touchpad_subscriptions[0] = subscribe_signal(kded_modules_touchpad_name, "org.kde.touchpad", "enabledChanged", kded_modules_touchpad_path, kded_modules_touchpad_handler);
+    kded_modules_touchpad_subscriptions[1] = subscribe_signal(kded_modules_touchpad_name, "org.kde.touchpad", "mousePluggedInChanged", kded_modules_touchpad_path, kded_modules_touchpad_handler);
+    if (kded_modules_touchpad_subscriptions[0] == 0 || kded_modules_touchpad_subscriptions[1] == 0) {
+        cerr << "setup_kde(...): g_dbus_connection_signal_subscribe(...) failed." << endl;
+        clean_kde();
         return EXIT_FAILURE;
     }
     
     // sync on wakeup
-    solid_power_management = g_dbus_proxy_new_for_bus_sync(G_BUS_TYPE_SESSION,
-                                                                       G_DBUS_PROXY_FLAGS_NONE, NULL,
-                                                                       "org.kde.Solid.PowerManagement",
-                                                                       "/org/kde/Solid/PowerManagement/Actions/SuspendSession",
-                                                                       "org.kde.Solid.PowerManagement.Actions.SuspendSession",
-                                                                       NULL, NULL);
-    if (solid_power_management == NULL) {
-        cerr << "setup_kde(...): g_dbus_proxy_new_for_bus_sync(...) failed." << endl;
-        g_clear_object(&kded_modules_touchpad);
-        return EXIT_FAILURE;
-    }
-    if (g_signal_connect(solid_power_management, "g-signal", G_CALLBACK(solid_power_management_handler), NULL) < 1) {
-        cerr << "setup_kde(...): g_signal_connect(...) failed." << endl;
+    solid_power_management_subscriptions[0] = subscribe_signal("org.kde.Solid.PowerManagement", "org.kde.Solid.PowerManagement.Actions.SuspendSession", "aboutToSuspend", "/org/kde/Solid/PowerManagement/Actions/SuspendSession", solid_power_management_handler);
+    solid_power_management_subscriptions[1] = subscribe_signal("org.kde.Solid.PowerManagement", "org.kde.Solid.PowerManagement.Actions.SuspendSession", "resumingFromSuspend", "/org/kde/Solid/PowerManagement/Actions/SuspendSession", solid_power_management_handler);
+    if (solid_power_management_subscriptions[0] == 0 || solid_power_management_subscriptions[1] == 0) {
+        cerr << "setup_kde(...): g_dbus_connection_signal_subscribe(...) failed." << endl;
         clean_kde();
         return EXIT_FAILURE;
     }
     
     // sync on start
-    if (kded_modules_touchpad_init(kded_modules_touchpad) == EXIT_FAILURE) {
+    if (kded_modules_touchpad_init() == EXIT_FAILURE) {
         cerr << "setup_kde(...): kded_modules_touchpad_init(...) failed." << endl;
         clean_kde();
         return EXIT_FAILURE;
@@ -245,6 +254,17 @@ int setup_kde(int lockfile_arg) {
 }
 
 void clean_kde() {
-    g_clear_object(&kded_modules_touchpad);
-    g_clear_object(&solid_power_management);
+    for (auto &subscription : kded_modules_touchpad_subscriptions) {
+        if (subscription) {
+            g_dbus_connection_signal_unsubscribe(session_bus, subscription);
+            subscription = 0;
+        }
+    }
+    for (auto &subscription : solid_power_management_subscriptions) {
+        if (subscription) {
+            g_dbus_connection_signal_unsubscribe(session_bus, subscription);
+            subscription = 0;
+        }
+    }
+    g_clear_object(&session_bus);
 }
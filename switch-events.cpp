@@ -0,0 +1,446 @@
+// Copyright (c) 2020 TUXEDO Computers GmbH <tux@tuxedocomputers.com>
+//
+// This file is part of TUXEDO Touchpad Switch.
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TUXEDO Touchpad Switch is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TUXEDO Touchpad Switch.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "switch-events.h"
+
+#include <iostream>
+#include <vector>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/input.h>
+
+#include <gio/gio.h>
+#include <glib-unix.h>
+
+#include <libudev.h>
+
+#include "touchpad-control.h"
+#include "trigger-stats.h"
+
+using std::cerr;
+using std::endl;
+
+#define BITS_PER_LONG (8 * sizeof(unsigned long))
+#define TEST_BIT(bit, array) ((array[(bit) / BITS_PER_LONG] >> ((bit) % BITS_PER_LONG)) & 1)
+// upper bound for the synchronous call to upower, it blocks the startup
+#define DBUS_CALL_TIMEOUT_MILLISECONDS 1000
+
+struct switch_device {
+    int fd;
+    guint source;
+    dev_t devnum;
+    bool has_lid;
+    bool has_tablet_mode;
+    // event timestamps are CLOCK_MONOTONIC, otherwise they can not be compared to g_get_monotonic_time()
+    bool monotonic_clock;
+    // events got lost, everything up to the next SYN_REPORT is incomplete and the state has to be read anew
+    bool dropped;
+};
+
+static std::vector<switch_device> switch_devices;
+static struct udev *udev_context = NULL;
+static struct udev_monitor *input_monitor = NULL;
+static guint input_monitor_source = 0;
+static GDBusConnection *system_bus = NULL;
+static guint upower_properties_subscription = 0;
+static bool lid_closed = false;
+static bool tablet_mode = false;
+
+static void apply_switch_state(const char *trigger, gint64 start_time) {
+    if (set_touchpad_forced_off(lid_closed || tablet_mode)) {
+        cerr << "apply_switch_state(...): set_touchpad_forced_off(...) failed." << endl;
+    }
+    record_trigger(trigger, start_time);
+}
+
+static void close_switch_device(switch_device *device) {
+    if (device->source) {
+        g_source_remove(device->source);
+        device->source = 0;
+    }
+    if (device->fd >= 0) {
+        close(device->fd);
+        device->fd = -1;
+    }
+}
+
+// reads the current state of the switches "switch_device *device" has, returns EXIT_SUCCESS or EXIT_FAILURE
+static int read_switch_state(switch_device *device) {
+    unsigned long switch_state[SW_CNT / BITS_PER_LONG + 1] = {0};
+    if (ioctl(device->fd, EVIOCGSW(sizeof(switch_state)), switch_state) < 0) {
+        return EXIT_FAILURE;
+    }
+    if (device->has_lid) {
+        lid_closed = TEST_BIT(SW_LID, switch_state);
+    }
+    if (device->has_tablet_mode) {
+        tablet_mode = TEST_BIT(SW_TABLET_MODE, switch_state);
+    }
+    return EXIT_SUCCESS;
+}
+
+static gboolean switch_device_handler(gint fd, __attribute__((unused)) GIOCondition condition, __attribute__((unused)) gpointer user_data) {
+    switch_device *device = NULL;
+    for (auto it = switch_devices.begin(); it != switch_devices.end(); ++it) {
+        if (it->fd == fd) {
+            device = &*it;
+            break;
+        }
+    }
+    if (!device) {
+        return G_SOURCE_REMOVE;
+    }
+    
+    struct input_event events[16];
+    ssize_t length;
+    // switch devices can have other switches too, e.g. for headphone jacks, those are of no interest
+    bool changed = false;
+    while ((length = read(fd, events, sizeof(events))) > 0) {
+        for (size_t i = 0; i < length / sizeof(events[0]); ++i) {
+            if (events[i].type == EV_SYN && events[i].code == SYN_DROPPED) {
+                device->dropped = true;
+            }
+            else if (device->dropped) {
+                if (events[i].type == EV_SYN && events[i].code == SYN_REPORT) {
+                    device->dropped = false;
+                    bool lid_closed_prev = lid_closed;
+                    bool tablet_mode_prev = tablet_mode;
+                    if (read_switch_state(device) != EXIT_SUCCESS) {
+                        cerr << "switch_device_handler(...): ioctl(..., EVIOCGSW(...), ...) failed." << endl;
+                    }
+                    changed |= lid_closed != lid_closed_prev || tablet_mode != tablet_mode_prev;
+                }
+                else {
+                    continue;
+                }
+            }
+            else if (events[i].type == EV_SW && events[i].code == SW_LID) {
+                changed |= lid_closed != (bool)events[i].value;
+                lid_closed = events[i].value;
+            }
+            else if (events[i].type == EV_SW && events[i].code == SW_TABLET_MODE) {
+                changed |= tablet_mode != (bool)events[i].value;
+                tablet_mode = events[i].value;
+            }
+            
+            if (events[i].type == EV_SYN && events[i].code == SYN_REPORT && changed) {
+                changed = false;
+                // with CLOCK_MONOTONIC timestamps this covers the whole way from the switch to the touchpad firmware
+                gint64 start_time = g_get_monotonic_time();
+                if (device->monotonic_clock) {
+                    start_time = (gint64)events[i].input_event_sec * G_USEC_PER_SEC + events[i].input_event_usec;
+                }
+                apply_switch_state("evdev switch", start_time);
+            }
+        }
+    }
+    
+    if (length < 0 && errno != EAGAIN && errno != EINTR) {
+        // the device is gone, e.g. an unplugged dock
+        cerr << "switch_device_handler(...): read(...) failed." << endl;
+        gint64 start_time = g_get_monotonic_time();
+        device->source = 0;
+        close_switch_device(device);
+        switch_devices.erase(switch_devices.begin() + (device - &switch_devices[0]));
+        
+        // a switch still active when its device went away must not keep the touchpads off, so the state gets rebuilt from
+        // the remaining devices, the lid state from upower stays as is
+        bool lid_closed_prev = lid_closed;
+        bool tablet_mode_prev = tablet_mode;
+        if (!upower_properties_subscription) {
+            lid_closed = false;
+        }
+        tablet_mode = false;
+        for (auto it = switch_devices.begin(); it != switch_devices.end(); ++it) {
+            // a failing device gets removed by its own handler
+            read_switch_state(&*it);
+        }
+        if (lid_closed != lid_closed_prev || tablet_mode != tablet_mode_prev) {
+            apply_switch_state("evdev switch removed", start_time);
+        }
+        return G_SOURCE_REMOVE;
+    }
+    
+    return G_SOURCE_CONTINUE;
+}
+
+// returns EXIT_SUCCESS if "const char *devnode" is an accessible lid or tablet mode switch and got added to switch_devices
+static int setup_switch_device(const char *devnode) {
+    int fd = open(devnode, O_RDONLY|O_NONBLOCK|O_CLOEXEC);
+    if (fd < 0) {
+        // only switch-only devices are readable for everyone, see res/99-tuxedo-touchpad-switch.rules, e.g. tablet mode
+        // switches sharing a device with keys stay accessible by root only, upower is the fallback then
+        return EXIT_FAILURE;
+    }
+    
+    // the udev monitor and the enumeration can both report the same device
+    struct stat device_stat;
+    if (fstat(fd, &device_stat)) {
+        close(fd);
+        return EXIT_FAILURE;
+    }
+    for (auto it = switch_devices.begin(); it != switch_devices.end(); ++it) {
+        if (it->devnum == device_stat.st_rdev) {
+            close(fd);
+            return EXIT_FAILURE;
+        }
+    }
+    
+    unsigned long switch_bits[SW_CNT / BITS_PER_LONG + 1] = {0};
+    if (ioctl(fd, EVIOCGBIT(EV_SW, sizeof(switch_bits)), switch_bits) < 0 ||
+        (!TEST_BIT(SW_LID, switch_bits) && !TEST_BIT(SW_TABLET_MODE, switch_bits))) {
+        close(fd);
+        return EXIT_FAILURE;
+    }
+    
+    switch_device device;
+    device.fd = fd;
+    device.source = 0;
+    device.devnum = device_stat.st_rdev;
+    device.has_lid = TEST_BIT(SW_LID, switch_bits);
+    device.has_tablet_mode = TEST_BIT(SW_TABLET_MODE, switch_bits);
+    device.dropped = false;
+    
+    int clock_id = CLOCK_MONOTONIC;
+    device.monotonic_clock = ioctl(fd, EVIOCSCLOCKID, &clock_id) == 0;
+    if (!device.monotonic_clock) {
+        cerr << "setup_switch_device(...): ioctl(..., EVIOCSCLOCKID, ...) on " << devnode << " failed." << endl;
+    }
+    
+    if (read_switch_state(&device) != EXIT_SUCCESS) {
+        cerr << "setup_switch_device(...): ioctl(..., EVIOCGSW(...), ...) on " << devnode << " failed." << endl;
+        close(fd);
+        return EXIT_FAILURE;
+    }
+    
+    device.source = g_unix_fd_add(fd, G_IO_IN, switch_device_handler, NULL);
+    if (!device.source) {
+        cerr << "setup_switch_device(...): g_unix_fd_add(...) failed." << endl;
+        close(fd);
+        return EXIT_FAILURE;
+    }
+    switch_devices.push_back(device);
+    
+    return EXIT_SUCCESS;
+}
+
+// returns true for the evdev nodes of input devices with switches, the rest of the checks is up to setup_switch_device(...)
+static bool is_switch_device(struct udev_device *input_device) {
+    const char *input_switch = udev_device_get_property_value(input_device, "ID_INPUT_SWITCH");
+    const char *devnode = udev_device_get_devnode(input_device);
+    return input_switch && !strcmp(input_switch, "1") &&
+           devnode && !strncmp(devnode, "/dev/input/event", strlen("/dev/input/event"));
+}
+
+// picks up switch devices plugged in later, e.g. with a dock, unplugged ones get removed by switch_device_handler(...)
+static gboolean input_monitor_handler(__attribute__((unused)) gint fd, __attribute__((unused)) GIOCondition condition, __attribute__((unused)) gpointer user_data) {
+    gint64 start_time = g_get_monotonic_time();
+    struct udev_device *input_device;
+    while ((input_device = udev_monitor_receive_device(input_monitor))) {
+        const char *action = udev_device_get_action(input_device);
+        if (action && !strcmp(action, "add") && is_switch_device(input_device)) {
+            bool lid_closed_prev = lid_closed;
+            bool tablet_mode_prev = tablet_mode;
+            if (setup_switch_device(udev_device_get_devnode(input_device)) == EXIT_SUCCESS &&
+                (lid_closed != lid_closed_prev || tablet_mode != tablet_mode_prev)) {
+                apply_switch_state("evdev switch added", start_time);
+            }
+        }
+        udev_device_unref(input_device);
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+static void setup_input_monitor() {
+    input_monitor = udev_monitor_new_from_netlink(udev_context, "udev");
+    if (!input_monitor) {
+        cerr << "setup_input_monitor(...): udev_monitor_new_from_netlink(...) failed." << endl;
+        return;
+    }
+    
+    if (udev_monitor_filter_add_match_subsystem_devtype(input_monitor, "input", NULL) < 0 ||
+        udev_monitor_enable_receiving(input_monitor) < 0) {
+        cerr << "setup_input_monitor(...): udev_monitor_...(...) failed." << endl;
+        udev_monitor_unref(input_monitor);
+        input_monitor = NULL;
+        return;
+    }
+    
+    input_monitor_source = g_unix_fd_add(udev_monitor_get_fd(input_monitor), G_IO_IN, input_monitor_handler, NULL);
+    if (!input_monitor_source) {
+        cerr << "setup_input_monitor(...): g_unix_fd_add(...) failed." << endl;
+        udev_monitor_unref(input_monitor);
+        input_monitor = NULL;
+    }
+}
+
+static void setup_switch_devices() {
+    udev_context = udev_new();
+    if (!udev_context) {
+        cerr << "setup_switch_devices(...): udev_new(...) failed." << endl;
+        return;
+    }
+    
+    // before the enumeration, so that no device plugged in meanwhile gets lost
+    setup_input_monitor();
+    
+    struct udev_enumerate *input_devices = udev_enumerate_new(udev_context);
+    if (!input_devices) {
+        cerr << "setup_switch_devices(...): udev_enumerate_new(...) failed." << endl;
+    }
+    else {
+        if (udev_enumerate_add_match_subsystem(input_devices, "input") < 0 ||
+            udev_enumerate_add_match_property(input_devices, "ID_INPUT_SWITCH", "1") < 0 ||
+            udev_enumerate_scan_devices(input_devices) < 0) {
+            cerr << "setup_switch_devices(...): udev_enumerate_...(...) failed." << endl;
+        }
+        else {
+            struct udev_list_entry *input_device_entry;
+            udev_list_entry_foreach(input_device_entry, udev_enumerate_get_list_entry(input_devices)) {
+                struct udev_device *input_device = udev_device_new_from_syspath(udev_context, udev_list_entry_get_name(input_device_entry));
+                if (input_device) {
+                    if (is_switch_device(input_device)) {
+                        setup_switch_device(udev_device_get_devnode(input_device));
+                    }
+                    udev_device_unref(input_device);
+                }
+            }
+        }
+        
+        udev_enumerate_unref(input_devices);
+    }
+}
+
+static void upower_properties_changed_handler(__attribute__((unused)) GDBusConnection *connection, __attribute__((unused)) const gchar *sender_name, __attribute__((unused)) const gchar *object_path, __attribute__((unused)) const gchar *interface_name, __attribute__((unused)) const gchar *signal_name, GVariant *parameters, __attribute__((unused)) gpointer user_data) {
+    gint64 start_time = g_get_monotonic_time();
+    if (g_variant_is_of_type(parameters, G_VARIANT_TYPE("(sa{sv}as)"))) {
+        GVariant *changed_properties = g_variant_get_child_value(parameters, 1);
+        GVariantDict changed_properties_dict;
+        gboolean lidClosed;
+
+        g_variant_dict_init(&changed_properties_dict, changed_properties);
+        if (g_variant_dict_lookup(&changed_properties_dict, "LidIsClosed", "b", &lidClosed)) {
+            lid_closed = lidClosed;
+            apply_switch_state("org.freedesktop.UPower LidIsClosed", start_time);
+        }
+        g_variant_dict_clear(&changed_properties_dict);
+        g_variant_unref(changed_properties);
+    }
+}
+
+static int setup_upower() {
+    system_bus = g_bus_get_sync(G_BUS_TYPE_SYSTEM, NULL, NULL);
+    if (system_bus == NULL) {
+        cerr << "setup_upower(...): g_bus_get_sync(...) failed." << endl;
+        return EXIT_FAILURE;
+    }
+    
+    // unlike "LidClosed" of logind, which is declared without change notification, "LidIsClosed" of upower gets announced
+    // via PropertiesChanged
+    upower_properties_subscription = g_dbus_connection_signal_subscribe(system_bus,
+                                                                        "org.freedesktop.UPower",
+                                                                        "org.freedesktop.DBus.Properties",
+                                                                        "PropertiesChanged",
+                                                                        "/org/freedesktop/UPower",
+                                                                        "org.freedesktop.UPower",
+                                                                        G_DBUS_SIGNAL_FLAGS_NONE,
+                                                                        upower_properties_changed_handler,
+                                                                        NULL, NULL);
+    if (upower_properties_subscription == 0) {
+        cerr << "setup_upower(...): g_dbus_connection_signal_subscribe(...) failed." << endl;
+        return EXIT_FAILURE;
+    }
+    
+    GVariant *lidClosedParam = g_dbus_connection_call_sync(system_bus,
+                                                           "org.freedesktop.UPower",
+                                                           "/org/freedesktop/UPower",
+                                                           "org.freedesktop.DBus.Properties",
+                                                           "Get",
+                                                           g_variant_new("(ss)", "org.freedesktop.UPower", "LidIsClosed"),
+                                                           G_VARIANT_TYPE("(v)"),
+                                                           G_DBUS_CALL_FLAGS_NONE,
+                                                           DBUS_CALL_TIMEOUT_MILLISECONDS, NULL, NULL);
+    if (lidClosedParam == NULL) {
+        cerr << "setup_upower(...): g_dbus_connection_call_sync(...) failed." << endl;
+        return EXIT_FAILURE;
+    }
+    GVariant *lidClosed;
+    g_variant_get(lidClosedParam, "(v)", &lidClosed);
+    if (g_variant_is_of_type(lidClosed, G_VARIANT_TYPE_BOOLEAN)) {
+        lid_closed = g_variant_get_boolean(lidClosed);
+    }
+    g_variant_unref(lidClosed);
+    g_variant_unref(lidClosedParam);
+    
+    return EXIT_SUCCESS;
+}
+
+int setup_switch_events() {
+    setup_switch_devices();
+    
+    if (switch_devices.empty()) {
+        if (setup_upower() != EXIT_SUCCESS) {
+            cerr << "setup_switch_events(...): setup_upower(...) failed." << endl;
+            clean_switch_events();
+            return EXIT_FAILURE;
+        }
+    }
+    
+    // sync on start, e.g. when logging in on a docked laptop with the lid closed
+    if (lid_closed || tablet_mode) {
+        apply_switch_state("switch state on start", g_get_monotonic_time());
+    }
+    
+    return EXIT_SUCCESS;
+}
+
+void clean_switch_events() {
+    for (auto it = switch_devices.begin(); it != switch_devices.end(); ++it) {
+        close_switch_device(&*it);
+    }
+    switch_devices.clear();
+    
+    if (input_monitor_source) {
+        g_source_remove(input_monitor_source);
+        input_monitor_source = 0;
+    }
+    if (input_monitor) {
+        udev_monitor_unref(input_monitor);
+        input_monitor = NULL;
+    }
+    if (udev_context) {
+        udev_unref(udev_context);
+        udev_context = NULL;
+    }
+    
+    if (upower_properties_subscription) {
+        g_dbus_connection_signal_unsubscribe(system_bus, upower_properties_subscription);
+        upower_properties_subscription = 0;
+    }
+    g_clear_object(&system_bus);
+    
+    lid_closed = false;
+    tablet_mode = false;
+}
@@ -0,0 +1,25 @@
+// Copyright (c) 2020 TUXEDO Computers GmbH <tux@tuxedocomputers.com>
+//
+// This file is part of TUXEDO Touchpad Switch.
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TUXEDO Touchpad Switch is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TUXEDO Touchpad Switch.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+// disables the built-in touchpads while the lid is closed or the device is folded into tablet mode and restores the
+// desired state afterwards, reads SW_LID and SW_TABLET_MODE from evdev where accessible, including switch devices plugged
+// in later, and falls back to "LidIsClosed" from upower, which has no tablet mode
+// returns EXIT_SUCCESS or EXIT_FAILURE, the events get dispatched by the glib mainloop
+int setup_switch_events();
+void clean_switch_events();
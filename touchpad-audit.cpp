@@ -0,0 +1,149 @@
+// Copyright (c) 2020 TUXEDO Computers GmbH <tux@tuxedocomputers.com>
+//
+// This file is part of TUXEDO Touchpad Switch.
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TUXEDO Touchpad Switch is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TUXEDO Touchpad Switch.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "touchpad-audit.h"
+
+#include <iostream>
+
+#include <cstdlib>
+
+#include <glib-unix.h>
+
+#include "touchpad-control.h"
+#include "trigger-stats.h"
+
+using std::cerr;
+using std::endl;
+
+// the periodic audit starts at the minimum interval and doubles on every consistent audit up to the maximum, so an idle
+// system wakes up only every few minutes
+#define AUDIT_INTERVAL_MIN_SECONDS 15
+#define AUDIT_INTERVAL_MAX_SECONDS 960
+// udev events come in bursts on rebinds, wait for them to settle before auditing
+#define AUDIT_UDEV_DELAY_MILLISECONDS 250
+
+static guint udev_monitor_source = 0;
+static guint udev_audit_source = 0;
+static guint periodic_audit_source = 0;
+static guint audit_interval = AUDIT_INTERVAL_MIN_SECONDS;
+
+static gboolean periodic_audit_handler(gpointer user_data);
+
+static void schedule_periodic_audit(guint interval) {
+    if (periodic_audit_source) {
+        g_source_remove(periodic_audit_source);
+    }
+    audit_interval = interval;
+    // g_timeout_add_seconds(...) lets glib batch the wakeup with other timers of the session
+    periodic_audit_source = g_timeout_add_seconds(audit_interval, periodic_audit_handler, NULL);
+}
+
+// stops the periodic audit while none of the touchpads is ours, e.g. in the greeter once a user session took over, in an
+// inactive session or on machines without a compatible touchpad, wake_touchpad_audit() restarts it
+static void reschedule_periodic_audit(guint interval) {
+    if (get_managed_touchpad_count() > 0) {
+        schedule_periodic_audit(interval);
+    }
+    else if (periodic_audit_source) {
+        g_source_remove(periodic_audit_source);
+        periodic_audit_source = 0;
+    }
+}
+
+static gboolean periodic_audit_handler(__attribute__((unused)) gpointer user_data) {
+    gint64 start_time = g_get_monotonic_time();
+    periodic_audit_source = 0;
+    
+    int drifted = audit_touchpad_states();
+    if (drifted < 0) {
+        cerr << "periodic_audit_handler(...): audit_touchpad_states(...) failed." << endl;
+    }
+    
+    if (drifted == 0) {
+        reschedule_periodic_audit(MIN(audit_interval * 2, AUDIT_INTERVAL_MAX_SECONDS));
+    }
+    else {
+        reschedule_periodic_audit(AUDIT_INTERVAL_MIN_SECONDS);
+    }
+    
+    record_trigger("touchpad audit timer", start_time);
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean udev_audit_handler(__attribute__((unused)) gpointer user_data) {
+    udev_audit_source = 0;
+    
+    if (audit_touchpad_states() < 0) {
+        cerr << "udev_audit_handler(...): audit_touchpad_states(...) failed." << endl;
+    }
+    
+    // the touchpad just went through a rebind, keep a closer eye on it for a while
+    reschedule_periodic_audit(AUDIT_INTERVAL_MIN_SECONDS);
+    
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean udev_monitor_handler(__attribute__((unused)) gint fd, __attribute__((unused)) GIOCondition condition, __attribute__((unused)) gpointer user_data) {
+    gint64 start_time = g_get_monotonic_time();
+    
+    // dispatched in any case, so that the list of touchpads stays up to date
+    if (dispatch_touchpad_events() && get_managed_touchpad_count() > 0 && !udev_audit_source) {
+        udev_audit_source = g_timeout_add(AUDIT_UDEV_DELAY_MILLISECONDS, udev_audit_handler, NULL);
+    }
+    
+    record_trigger("udev", start_time);
+    return G_SOURCE_CONTINUE;
+}
+
+int setup_touchpad_audit() {
+    int touchpad_event_fd = get_touchpad_event_fd();
+    if (touchpad_event_fd < 0) {
+        cerr << "setup_touchpad_audit(...): get_touchpad_event_fd(...) failed." << endl;
+        return EXIT_FAILURE;
+    }
+    
+    udev_monitor_source = g_unix_fd_add(touchpad_event_fd, G_IO_IN, udev_monitor_handler, NULL);
+    if (!udev_monitor_source) {
+        cerr << "setup_touchpad_audit(...): g_unix_fd_add(...) failed." << endl;
+        return EXIT_FAILURE;
+    }
+    
+    reschedule_periodic_audit(AUDIT_INTERVAL_MIN_SECONDS);
+    
+    return EXIT_SUCCESS;
+}
+
+void wake_touchpad_audit() {
+    if (udev_monitor_source && !periodic_audit_source) {
+        reschedule_periodic_audit(AUDIT_INTERVAL_MIN_SECONDS);
+    }
+}
+
+void clean_touchpad_audit() {
+    if (periodic_audit_source) {
+        g_source_remove(periodic_audit_source);
+        periodic_audit_source = 0;
+    }
+    if (udev_audit_source) {
+        g_source_remove(udev_audit_source);
+        udev_audit_source = 0;
+    }
+    if (udev_monitor_source) {
+        g_source_remove(udev_monitor_source);
+        udev_monitor_source = 0;
+    }
+}
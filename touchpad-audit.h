@@ -0,0 +1,28 @@
+// Copyright (c) 2020 TUXEDO Computers GmbH <tux@tuxedocomputers.com>
+//
+// This file is part of TUXEDO Touchpad Switch.
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TUXEDO Touchpad Switch is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TUXEDO Touchpad Switch.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+// watches udev for touchpad (re)binds and periodically reads the touchpad state back from the firmware, restoring it if
+// it drifted, e.g. after an i2c_hid reset or a BIOS hotkey
+// returns EXIT_SUCCESS or EXIT_FAILURE, the events get dispatched by the glib mainloop
+int setup_touchpad_audit();
+void clean_touchpad_audit();
+
+// restarts the periodic audit if it was stopped because none of the touchpads had a desired state, does nothing before
+// setup_touchpad_audit()
+void wake_touchpad_audit();
@@ -18,177 +18,164 @@
 #include "touchpad-control.h"
 
 #include <iostream>
-#include <vector>
-#include <string>
-#include <algorithm>
-#include <iomanip>
 
-#include <cstring>
+#include <cerrno>
+#include <cstdlib>
 
-#include <fcntl.h>
-#include <unistd.h>
-#include <sys/ioctl.h>
-#include <linux/hidraw.h>
-
-#include <libudev.h>
+#include "tuxedo-touchpad-internal.h"
+#include "touchpad-audit.h"
 
 using std::cerr;
 using std::endl;
 
-// "std::vector<std::string> *devnodes" gets amended with found "/dev/hidraw*" device paths
-// returns -EXIT_FAILURE on error or the number of found "i2c-UNIW0001:00"-touchpads, starting with 0, meaning no touchpads found
-static int get_touchpad_hidraw_devices(std::vector<std::string> *devnodes) {
-    int result = -EXIT_FAILURE;
-    
-    struct udev *udev_context = udev_new();
-    if (!udev_context) {
-        cerr << "get_touchpad_hidraw_devices(...): udev_new(...) failed." << endl;
-    }
-    else {
-        struct udev_enumerate *hidraw_devices = udev_enumerate_new(udev_context);
-        if (!hidraw_devices) {
-            cerr << "get_touchpad_hidraw_devices(...): udev_enumerate_new(...) failed." << endl;
-        }
-        else {
-            if (udev_enumerate_add_match_subsystem(hidraw_devices, "hidraw") < 0) {
-                cerr << "get_touchpad_hidraw_devices(...): udev_enumerate_add_match_subsystem(...) failed." << endl;
-            }
-            else {
-                if (udev_enumerate_scan_devices(hidraw_devices) < 0) {
-                    cerr << "get_touchpad_hidraw_devices(...): udev_enumerate_scan_devices(...) failed." << endl;
-                }
-                else {
-                    struct udev_list_entry *hidraw_devices_iterator = udev_enumerate_get_list_entry(hidraw_devices);
-                    if (!hidraw_devices_iterator) {
-                        cerr << "get_touchpad_hidraw_devices(...): udev_enumerate_get_list_entry(...) failed." << endl;
-                    }
-                    else {
-                        struct udev_list_entry *hidraw_device_entry;
-                        udev_list_entry_foreach(hidraw_device_entry, hidraw_devices_iterator) {
-                            if (strstr(udev_list_entry_get_name(hidraw_device_entry), "i2c-UNIW0001:00")) {
-                                struct udev_device *hidraw_device = udev_device_new_from_syspath(udev_context, udev_list_entry_get_name(hidraw_device_entry));
-                                if (!hidraw_device) {
-                                    cerr << "get_touchpad_hidraw_devices(...): udev_device_new_from_syspath(...) failed." << endl;
-                                }
-                                else {
-                                    std::string devnode = udev_device_get_devnode(hidraw_device);
-                                    devnodes->push_back(devnode);
-                                    
-                                    udev_device_unref(hidraw_device);
-                                }
-                            }
-                        }
-                        
-                        result = devnodes->size();
-                    }
-                }
-            }
-            
-            udev_enumerate_unref(hidraw_devices);
-        }
-        
-        udev_unref(udev_context);
-    }
+// opened on first use and kept for the lifetime of the process, so the touchpads only get discovered once
+static struct tuxedo_touchpad *touchpad_context = NULL;
+// retaken after every call that might have rediscovered the touchpads, see restore_touchpad_state_from_signal()
+static struct tuxedo_touchpad_restore_snapshot restore_snapshot = {};
 
-    return result;
+static void update_restore_snapshot() {
+    if (touchpad_context) {
+        tuxedo_touchpad_take_restore_snapshot(touchpad_context, &restore_snapshot);
+    }
 }
 
-static int get_hidraw_surface_button_switch_report_id(std::string devnode) {
-    int result = 0;
+static struct tuxedo_touchpad *get_touchpad_context() {
+    if (!touchpad_context) {
+        touchpad_context = tuxedo_touchpad_open(NULL);
+        if (!touchpad_context) {
+            cerr << "get_touchpad_context(...): tuxedo_touchpad_open(...) failed." << endl;
+        }
+        update_restore_snapshot();
+    }
+    return touchpad_context;
+}
 
-    int hidraw = open(devnode.c_str(), O_WRONLY|O_NONBLOCK);
-    if (hidraw < 0) {
-        cerr << "get_hidraw_surface_button_switch_report_id(...): open(\"" << devnode << "\", O_WRONLY|O_NONBLOCK) failed." << endl;
-        return -EXIT_FAILURE;
+int setup_touchpad_control() {
+    if (!get_touchpad_context()) {
+        cerr << "setup_touchpad_control(...): get_touchpad_context(...) failed." << endl;
+        return EXIT_FAILURE;
     }
-    else {
-        struct hidraw_report_descriptor report_descriptor;
+    return EXIT_SUCCESS;
+}
 
-        result = ioctl(hidraw, HIDIOCGRDESCSIZE, &report_descriptor.size);
-        if (result < 0) {
-            cerr << "get_hidraw_surface_button_switch_report_id(...): ioctl(..., HIDIOCGRDESCSIZE, ...) on " << devnode << " failed." << endl;
-            close(hidraw);
-            return -EXIT_FAILURE;
-        }
+static int apply_touchpad_state(int enabled) {
+    struct tuxedo_touchpad *context = get_touchpad_context();
+    if (!context) {
+        cerr << "apply_touchpad_state(...): get_touchpad_context(...) failed." << endl;
+        return EXIT_FAILURE;
+    }
+    
+    int result = tuxedo_touchpad_set_state(context, enabled);
+    update_restore_snapshot();
+    if (result == -ENODEV) {
+        cerr << "No compatible touchpads found." << endl;
+        return EXIT_FAILURE;
+    }
+    if (result < 0) {
+        cerr << "apply_touchpad_state(...): tuxedo_touchpad_set_state(...) failed." << endl;
+        return EXIT_FAILURE;
+    }
+    
+    return EXIT_SUCCESS;
+}
 
-        result = ioctl(hidraw, HIDIOCGRDESC, &report_descriptor);
-        if (result < 0) {
-            cerr << "get_hidraw_surface_button_switch_report_id(...): ioctl(..., HIDIOCGRDESC, ...) on " << devnode << " failed." << endl;
-            close(hidraw);
-            return -EXIT_FAILURE;
-        }
+int set_touchpad_state(int enabled) {
+    int result = apply_touchpad_state(enabled ? 1 : 0);
+    wake_touchpad_audit();
+    return result;
+}
 
-        close(hidraw);
+int set_touchpad_forced_off(int forced_off) {
+    struct tuxedo_touchpad *context = get_touchpad_context();
+    if (!context) {
+        cerr << "set_touchpad_forced_off(...): get_touchpad_context(...) failed." << endl;
+        return EXIT_FAILURE;
+    }
+    
+    // only the built-in touchpads, the one of a dock stays usable with the lid closed, and only while the touchpads are
+    // ours, otherwise the flag just gets remembered
+    int result = tuxedo_touchpad_set_builtin_forced_off(context, forced_off);
+    update_restore_snapshot();
+    if (result < 0) {
+        cerr << "set_touchpad_forced_off(...): tuxedo_touchpad_set_builtin_forced_off(...) failed." << endl;
+        return EXIT_FAILURE;
+    }
+    
+    return EXIT_SUCCESS;
+}
 
-        __u8 surface_button_switch_collection_identifier[] = {0x05, 0x0d, 0x09, 0x22, 0xa1, 0x00, 0x09, 0x57, 0x09, 0x58};
-        auto it1 = std::search(std::begin(report_descriptor.value), std::end(report_descriptor.value), std::begin(surface_button_switch_collection_identifier), std::end(surface_button_switch_collection_identifier));
-        for (auto it2 = it1; it2 != std::end(report_descriptor.value); ++it2) {
-            if (*it2 == 0x85 && std::next(it2) != std::end(report_descriptor.value)) {
-                return *(std::next(it2));
-            }
-        }
+int restore_touchpad_state() {
+    if (!touchpad_context) {
+        return EXIT_SUCCESS;
+    }
+    
+    if (tuxedo_touchpad_restore(touchpad_context) < 0) {
+        cerr << "restore_touchpad_state(...): tuxedo_touchpad_restore(...) failed." << endl;
+        return EXIT_FAILURE;
     }
+    
+    return EXIT_SUCCESS;
+}
 
-    return -EXIT_FAILURE;
+void restore_touchpad_state_from_signal() {
+    tuxedo_touchpad_restore_from_snapshot(&restore_snapshot);
 }
 
-int set_touchpad_state(int enabled) {
-    std::vector<std::string> devnodes;
-    int touchpad_count = get_touchpad_hidraw_devices(&devnodes);
-    if (touchpad_count < 0) {
-        cerr << "send_events_handler(...): get_touchpad_hidraw_devices(...) failed." << endl;
-        return EXIT_FAILURE;
+void reset_touchpad_states() {
+    if (touchpad_context) {
+        tuxedo_touchpad_reset(touchpad_context);
     }
-    if (touchpad_count == 0) {
-        cerr << "No compatible touchpads found." << endl;
-        return EXIT_FAILURE;
+}
+
+int audit_touchpad_states() {
+    struct tuxedo_touchpad *context = get_touchpad_context();
+    if (!context) {
+        cerr << "audit_touchpad_states(...): get_touchpad_context(...) failed." << endl;
+        return -EXIT_FAILURE;
     }
     
-    int result = EXIT_SUCCESS;
+    int drifted = tuxedo_touchpad_audit(context);
+    update_restore_snapshot();
+    if (drifted < 0) {
+        cerr << "audit_touchpad_states(...): tuxedo_touchpad_audit(...) failed." << endl;
+        return -EXIT_FAILURE;
+    }
+    if (drifted > 0) {
+        cerr << "Touchpad state drift detected, " << tuxedo_touchpad_get_drift_count(context) << " in total, restored." << endl;
+    }
     
-    for (auto it = devnodes.begin(); it != devnodes.end(); ++it) {
-        int feature_report_id = get_hidraw_surface_button_switch_report_id(*it);
-        if (feature_report_id < 0) {
-            cerr << "set_touchpad_state(...): get_hidraw_surface_button_switch_report_id(...) failed." << endl;
-            result = EXIT_FAILURE;
-        }
-        else {
-            int hidraw = open((*it).c_str(), O_WRONLY|O_NONBLOCK);
-            if (hidraw < 0) {
-                cerr << "set_touchpad_state(...): open(\"" << *it << "\", O_WRONLY|O_NONBLOCK) failed." << endl;
-                result = EXIT_FAILURE;
-            }
-            else {
-                // To enable touchpad send "0x03" as feature report to the touchpad hid device. The feature report number can be gathered from the report descriptors.
-                // To disable it send "0x00".
-                // Reference: https://docs.microsoft.com/en-us/windows-hardware/design/component-guidelines/touchpad-configuration-collection#selective-reporting-feature-report
-                // Details:
-                // The two rightmost bits control the touchpad status
-                // In order, they are:
-                // 1. LED off + touchpad on/LED on + touchpad off
-                // 2. Clicks on/off
-                // So, the options are:
-                // 0x00 LED on, touchpad off, touchpad click off
-                // 0x01 LED on, touchpad off, touchpad click on
-                // 0x02 LED off, touchpad on, touchpad click off
-                // 0x03 LED off, touchpad on, touchpad click on
-                char buffer[2] = {static_cast<char>(feature_report_id), 0x00};
-                if (enabled) {
-                    buffer[1] = 0x03;
-                }
-
-                result = ioctl(hidraw, HIDIOCSFEATURE(sizeof(buffer)/sizeof(buffer[0])), buffer);
-                if (result < 0) {
-                    cerr << "set_touchpad_state(...): ioctl(...) on " << *it << " failed." << endl;
-                    result = EXIT_FAILURE;
-                }
-
-                close(hidraw);
-
-                result = EXIT_SUCCESS;
-            }
-        }
+    return drifted;
+}
+
+int get_managed_touchpad_count() {
+    if (!touchpad_context) {
+        return 0;
     }
     
-    return result;
+    return tuxedo_touchpad_get_managed_count(touchpad_context);
+}
+
+int get_touchpad_event_fd() {
+    struct tuxedo_touchpad *context = get_touchpad_context();
+    if (!context) {
+        cerr << "get_touchpad_event_fd(...): get_touchpad_context(...) failed." << endl;
+        return -EXIT_FAILURE;
+    }
+    
+    return tuxedo_touchpad_get_fd(context);
+}
+
+int dispatch_touchpad_events() {
+    if (!touchpad_context) {
+        return 0;
+    }
+    
+    return tuxedo_touchpad_dispatch(touchpad_context);
+}
+
+void clean_touchpad_control() {
+    // the file descriptors get closed below
+    restore_snapshot.count = 0;
+    tuxedo_touchpad_close(touchpad_context);
+    touchpad_context = NULL;
 }
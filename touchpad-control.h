@@ -17,6 +17,48 @@
 
 #pragma once
 
-// "int enable" set to 0 disables the touchpad, any other value enables it
+// opens the touchpads of the seat of the current session ahead of time, so that restore_touchpad_state() has them ready
+// returns EXIT_SUCCESS or EXIT_FAILURE
+int setup_touchpad_control();
+
+// "int enable" set to 0 disables the touchpads on the seat of the current session ($XDG_SEAT, defaults to "seat0"), any
+// other value enables them, only touchpads whose last applied state differs get written to
 // returns EXIT_SUCCESS or EXIT_FAILURE accordingly, on fail the activate/deactivate state of found touchpads is undefined
 int set_touchpad_state(int enabled);
+
+// "int forced_off" set to anything but 0 disables the built-in touchpads regardless of the state set via
+// set_touchpad_state(...), e.g. while the lid is closed, 0 restores that state again, touchpads of a dock are left alone
+// returns EXIT_SUCCESS or EXIT_FAILURE
+int set_touchpad_forced_off(int forced_off);
+
+// enables the touchpads opened so far, without rediscovering them and regardless of set_touchpad_forced_off(...), for use
+// on shutdown and before handing the touchpads over to another session
+// returns EXIT_SUCCESS or EXIT_FAILURE
+int restore_touchpad_state();
+
+// like restore_touchpad_state(), but async-signal-safe, for a last attempt when the mainloop does not get to
+// restore_touchpad_state() in time, writes to the touchpads as of the last call of the other functions
+void restore_touchpad_state_from_signal();
+
+// forgets the last applied and desired state of all touchpads, so that the next set_touchpad_state(...) call writes to
+// every touchpad again
+// use after the touchpads were handed over to another session or could have been reset, e.g. by a suspend
+void reset_touchpad_states();
+
+// reads the state back from the firmware of all touchpads on the seat of the current session that have a desired state
+// and rewrites it on mismatch
+// returns -EXIT_FAILURE on error or the number of touchpads that had drifted, starting with 0, meaning all are consistent
+int audit_touchpad_states();
+
+// returns the number of touchpads with a desired state, 0 meaning they are not ours at the moment, see
+// reset_touchpad_states()
+int get_managed_touchpad_count();
+
+// returns a file descriptor that becomes readable when touchpads get added, removed or rebound or -EXIT_FAILURE on error
+int get_touchpad_event_fd();
+// call when the file descriptor from get_touchpad_event_fd() becomes readable
+// returns a combination of the TUXEDO_TOUCHPAD_EVENT_* flags from "tuxedo-touchpad.h"
+int dispatch_touchpad_events();
+
+// closes the touchpads, the next call of any of the functions above reopens them
+void clean_touchpad_control();
@@ -0,0 +1,89 @@
+// Copyright (c) 2020 TUXEDO Computers GmbH <tux@tuxedocomputers.com>
+//
+// This file is part of TUXEDO Touchpad Switch.
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TUXEDO Touchpad Switch is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TUXEDO Touchpad Switch.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "trigger-stats.h"
+
+#include <iostream>
+#include <map>
+#include <string>
+
+#include <cstdlib>
+
+#include <gio/gio.h>
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+struct trigger_stats {
+    unsigned long count = 0;
+    gint64 total_time = 0;
+    gint64 max_time = 0;
+};
+
+static std::map<std::string, trigger_stats> triggers;
+static GDBusConnection *session_bus = NULL;
+static guint dbus_message_filter = 0;
+// incremented on the GDBus worker thread
+static gint dbus_message_count = 0;
+
+void record_trigger(const char *trigger, gint64 start_time) {
+    gint64 time = g_get_monotonic_time() - start_time;
+    
+    trigger_stats *stats = &triggers[trigger];
+    ++stats->count;
+    stats->total_time += time;
+    if (time > stats->max_time) {
+        stats->max_time = time;
+    }
+}
+
+static GDBusMessage *dbus_message_filter_handler(__attribute__((unused)) GDBusConnection *connection, GDBusMessage *message, gboolean incoming, __attribute__((unused)) gpointer user_data) {
+    if (incoming) {
+        g_atomic_int_inc(&dbus_message_count);
+    }
+    return message;
+}
+
+int setup_dbus_message_stats() {
+    session_bus = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, NULL);
+    if (session_bus == NULL) {
+        cerr << "setup_dbus_message_stats(...): g_bus_get_sync(...) failed." << endl;
+        return EXIT_FAILURE;
+    }
+    
+    dbus_message_filter = g_dbus_connection_add_filter(session_bus, dbus_message_filter_handler, NULL, NULL);
+    
+    return EXIT_SUCCESS;
+}
+
+void clean_dbus_message_stats() {
+    if (dbus_message_filter) {
+        g_dbus_connection_remove_filter(session_bus, dbus_message_filter);
+        dbus_message_filter = 0;
+    }
+    g_clear_object(&session_bus);
+}
+
+void print_trigger_stats() {
+    for (auto it = triggers.begin(); it != triggers.end(); ++it) {
+        cout << it->first << ": " << it->second.count << " handled, "
+             << it->second.total_time / it->second.count << " us average, "
+             << it->second.max_time << " us maximum" << endl;
+    }
+    cout << "session bus: " << g_atomic_int_get(&dbus_message_count) << " messages received" << endl;
+}
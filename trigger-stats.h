@@ -0,0 +1,35 @@
+// Copyright (c) 2020 TUXEDO Computers GmbH <tux@tuxedocomputers.com>
+//
+// This file is part of TUXEDO Touchpad Switch.
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TUXEDO Touchpad Switch is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TUXEDO Touchpad Switch.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <glib.h>
+
+// counts one handled event of "const char *trigger" and the time it took from "gint64 start_time", gathered via
+// g_get_monotonic_time(), until now
+// only events that reach a handler are counted, see setup_dbus_message_stats() for all messages received
+void record_trigger(const char *trigger, gint64 start_time);
+
+// counts every message the session bus connection receives, whether any handler is interested or not, so that the
+// wakeups caused by D-Bus can be compared between builds, e.g. with match rules and with proxies
+// returns EXIT_SUCCESS or EXIT_FAILURE
+int setup_dbus_message_stats();
+void clean_dbus_message_stats();
+
+// prints the number of handled events and the average and maximum handling time of every trigger seen so far and the
+// number of received D-Bus messages to stdout
+void print_trigger_stats();
@@ -0,0 +1,60 @@
+// Copyright (c) 2020 TUXEDO Computers GmbH <tux@tuxedocomputers.com>
+//
+// This file is part of TUXEDO Touchpad Switch.
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TUXEDO Touchpad Switch is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TUXEDO Touchpad Switch.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+// parts of libtuxedo-touchpad only used by tuxedo-touchpad-switch itself, for handing the touchpads over between sessions,
+// the lid and tablet mode override and scheduling its audit, not exported from the shared library and not part of its
+// stable C API
+
+#include <csignal>
+
+#include "tuxedo-touchpad.h"
+
+#define TUXEDO_TOUCHPAD_RESTORE_SNAPSHOT_SIZE 8
+
+// what tuxedo_touchpad_restore(...) would write to, usable from signal context, see
+// tuxedo_touchpad_restore_from_snapshot(...)
+struct tuxedo_touchpad_restore_snapshot {
+    // written last when taking the snapshot, entries beyond it are not to be used
+    volatile sig_atomic_t count;
+    int hidraw[TUXEDO_TOUCHPAD_RESTORE_SNAPSHOT_SIZE];
+    int feature_report_id[TUXEDO_TOUCHPAD_RESTORE_SNAPSHOT_SIZE];
+};
+
+// forgets the last applied and desired state of all touchpads, so that the next tuxedo_touchpad_set_state(...) call
+// writes to every touchpad again and tuxedo_touchpad_audit(...) leaves them alone until then
+// use after the touchpads were handed over to another process or could have been reset, e.g. by a suspend
+void tuxedo_touchpad_reset(struct tuxedo_touchpad *context);
+
+// "int forced_off" set to anything but 0 keeps the built-in touchpads, i.e. those not attached via usb, disabled
+// regardless of the state set via tuxedo_touchpad_set_state(...), e.g. while the lid is closed, 0 lets them follow it
+// again, touchpads of a dock are left alone, only touchpads with a desired state get written to
+// returns 0 or a negative errno value on error
+int tuxedo_touchpad_set_builtin_forced_off(struct tuxedo_touchpad *context, int forced_off);
+
+// returns the number of touchpads with a desired state, i.e. set via tuxedo_touchpad_set_state(...) and not reset since,
+// 0 meaning tuxedo_touchpad_audit(...) has nothing to do
+int tuxedo_touchpad_get_managed_count(struct tuxedo_touchpad *context);
+
+// fills "struct tuxedo_touchpad_restore_snapshot *snapshot" with the open hidraw file descriptors and feature report ids
+// of the touchpads of the seat, to be retaken after every call that might have rediscovered the touchpads
+void tuxedo_touchpad_take_restore_snapshot(struct tuxedo_touchpad *context, struct tuxedo_touchpad_restore_snapshot *snapshot);
+
+// enables the touchpads of "const struct tuxedo_touchpad_restore_snapshot *snapshot", only uses async-signal-safe calls,
+// for a last attempt from a signal handler when tuxedo_touchpad_restore(...) can not be reached anymore
+void tuxedo_touchpad_restore_from_snapshot(const struct tuxedo_touchpad_restore_snapshot *snapshot);
@@ -16,41 +16,64 @@
 // along with TUXEDO Touchpad Switch.  If not, see <https://www.gnu.org/licenses/>.
 
 #include <iostream>
+#include <string>
 
 #include <cstdlib>
 #include <csignal>
+#include <cerrno>
+#include <cctype>
 
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/file.h>
 
 #include <gio/gio.h>
+#include <glib-unix.h>
 
 #include "touchpad-control.h"
+#include "touchpad-audit.h"
+#include "trigger-stats.h"
 #include "setup-gnome.h"
 #include "setup-kde.h"
+#ifdef WITH_SWITCH_EVENTS
+#include "switch-events.h"
+#endif
 
 using std::cout;
 using std::cerr;
 using std::endl;
 
+// upper bound for the teardown after SIGINT, SIGTERM or SIGHUP, afterwards SIGALRM terminates the process, so that logout
+// and reboot never wait on us, armed directly in the signal handler as the mainloop might be blocked in a synchronous call
+// longer than DBUS_CALL_TIMEOUT_MILLISECONDS, so a regular teardown still fits after a blocking D-Bus call timed out
+#define SHUTDOWN_TIMEOUT_SECONDS 3
+// one lock per seat, so that only the sessions sharing the touchpads wait for each other, the directory is created by
+// res/tuxedo-touchpad-switch.conf via systemd-tmpfiles
+#define LOCKFILE_DIRECTORY "/run/tuxedo-touchpad-switch/"
+
 static int lockfile = -1;
+static GMainLoop *app = NULL;
+static gint64 shutdown_start_time = 0;
+static int shutdown_pipe[2] = {-1, -1};
+static volatile sig_atomic_t shutdown_requested = 0;
 
 static void gracefull_exit(int signum = 0) {
     int result = EXIT_SUCCESS;
     
-    clean_gnome();
-    clean_kde();
-    
     if (signum < 0) {
         result = EXIT_FAILURE;
     }
     
-    if (set_touchpad_state(1) != EXIT_SUCCESS) {
-        cerr << "gracefull_exit(...): set_touchpad_state(...) failed." << endl;
+    // restore first and only with the touchpads opened on startup, everything else is less important
+    if (restore_touchpad_state() != EXIT_SUCCESS) {
+        cerr << "gracefull_exit(...): restore_touchpad_state(...) failed." << endl;
         result = EXIT_FAILURE;
     }
     
+    if (shutdown_start_time) {
+        record_trigger("shutdown", shutdown_start_time);
+    }
+    
     if (lockfile >= 0) {
         if (flock(lockfile, LOCK_UN)) {
             cerr << "gracefull_exit(...): flock(...) failed." << endl;
@@ -62,39 +85,140 @@ static void gracefull_exit(int signum = 0) {
         }
     }
     
+#ifdef WITH_SWITCH_EVENTS
+    clean_switch_events();
+#endif
+    clean_touchpad_audit();
+    clean_gnome();
+    clean_kde();
+    clean_touchpad_control();
+    clean_dbus_message_stats();
+    
+    print_trigger_stats();
+    
     exit(result);
 }
 
+// runs in signal context, so only async-signal-safe calls, the mainloop gets woken up via the self-pipe
+static void shutdown_signal_handler(__attribute__((unused)) int signum) {
+    int saved_errno = errno;
+    if (!shutdown_requested) {
+        shutdown_requested = 1;
+        alarm(SHUTDOWN_TIMEOUT_SECONDS);
+        char byte = 0;
+        // the pipe is non-blocking and only ever gets this one byte, nothing to do if it fails anyway
+        ssize_t written = write(shutdown_pipe[1], &byte, 1);
+        (void)written;
+    }
+    errno = saved_errno;
+}
+
+// runs in signal context once SHUTDOWN_TIMEOUT_SECONDS passed, the touchpads must not stay disabled for the greeter or
+// the console, so they get enabled with the file descriptors opened so far before terminating
+static void shutdown_timeout_handler(__attribute__((unused)) int signum) {
+    restore_touchpad_state_from_signal();
+    _exit(EXIT_FAILURE);
+}
+
+// runs on the glib mainloop, not in signal context, the actual teardown happens once g_main_loop_run(...) returned
+static gboolean shutdown_handler(gint fd, __attribute__((unused)) GIOCondition condition, __attribute__((unused)) gpointer user_data) {
+    char byte;
+    while (read(fd, &byte, 1) > 0);
+    if (!shutdown_start_time) {
+        shutdown_start_time = g_get_monotonic_time();
+        g_main_loop_quit(app);
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+// returns an open file descriptor of the lock file of the seat of the current session ($XDG_SEAT, defaults to "seat0") or -1
+// on error
+static int open_seat_lockfile() {
+    const char *seat = getenv("XDG_SEAT");
+    if (!seat || !seat[0]) {
+        seat = "seat0";
+    }
+    // seat names are restricted by logind anyway, this keeps the path inside LOCKFILE_DIRECTORY
+    for (const char *it = seat; *it; ++it) {
+        if (!isalnum((unsigned char)*it) && *it != '-' && *it != '_') {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    std::string path = std::string(LOCKFILE_DIRECTORY) + seat + ".lock";
+    
+    // the directory is world writable and sticky, so the first session on a seat creates the file, later sessions of
+    // other users open it without O_CREAT as fs.protected_regular denies O_CREAT on files owned by someone else there
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        int fd = open(path.c_str(), O_RDONLY|O_CLOEXEC);
+        if (fd >= 0 || errno != ENOENT) {
+            return fd;
+        }
+        fd = open(path.c_str(), O_RDONLY|O_CREAT|O_EXCL|O_CLOEXEC, 0644);
+        if (fd >= 0 || errno != EEXIST) {
+            return fd;
+        }
+    }
+    return -1;
+}
+
 int main() {
-    struct sigaction sigaction_gracefull_exit;
-    sigaction_gracefull_exit.sa_handler = gracefull_exit;
-    sigemptyset(&sigaction_gracefull_exit.sa_mask);
-    sigaction_gracefull_exit.sa_flags = 0;
+    // until the signal handlers are installed below, the default action of SIGINT, SIGTERM and SIGHUP terminates us
+    // right away, which is fine as the touchpads were not touched yet, e.g. while waiting for the lock
+    lockfile = open_seat_lockfile();
+    if (lockfile == -1) {
+        cerr << "main(...): open_seat_lockfile(...) failed." << endl;
+        gracefull_exit(-EXIT_FAILURE);
+    }
     
-    if (sigaction(SIGINT, &sigaction_gracefull_exit, nullptr)) {
-        cerr << "main(...): sigaction(...) failed." << endl;
+    if (flock(lockfile, LOCK_EX) == -1) {
+        cerr << "main(...): flock(...) failed." << endl;
         gracefull_exit(-EXIT_FAILURE);
     }
-    if (sigaction(SIGTERM, &sigaction_gracefull_exit, nullptr)) {
-        cerr << "main(...): sigaction(...) failed." << endl;
+    
+    app = g_main_loop_new(NULL, FALSE);
+    if (!app) {
+        cerr << "main(...): g_main_loop_new(...) failed." << endl;
         gracefull_exit(-EXIT_FAILURE);
     }
-    if (sigaction(SIGHUP, &sigaction_gracefull_exit, nullptr)) {
-        cerr << "main(...): sigaction(...) failed." << endl;
+    
+    if (pipe2(shutdown_pipe, O_NONBLOCK | O_CLOEXEC)) {
+        cerr << "main(...): pipe2(...) failed." << endl;
         gracefull_exit(-EXIT_FAILURE);
     }
     
-    lockfile = open("/etc/tuxedo-touchpad-switch-lockfile", O_RDONLY);
-    if (lockfile == -1) {
-        cerr << "main(...): open(...) failed." << endl;
+    if (!g_unix_fd_add(shutdown_pipe[0], G_IO_IN, shutdown_handler, NULL)) {
+        cerr << "main(...): g_unix_fd_add(...) failed." << endl;
         gracefull_exit(-EXIT_FAILURE);
     }
     
-    if (flock(lockfile, LOCK_EX) == -1) {
-        cerr << "main(...): flock(...) failed." << endl;
+    // signals arriving during the setup below arm the shutdown timeout right away and get handled as soon as the mainloop
+    // runs, SA_RESTART as the rest of the code does not expect EINTR
+    struct sigaction shutdown_action = {};
+    shutdown_action.sa_handler = shutdown_signal_handler;
+    sigemptyset(&shutdown_action.sa_mask);
+    shutdown_action.sa_flags = SA_RESTART;
+    struct sigaction shutdown_timeout_action = {};
+    shutdown_timeout_action.sa_handler = shutdown_timeout_handler;
+    sigemptyset(&shutdown_timeout_action.sa_mask);
+    if (sigaction(SIGALRM, &shutdown_timeout_action, NULL) ||
+        sigaction(SIGINT, &shutdown_action, NULL) ||
+        sigaction(SIGTERM, &shutdown_action, NULL) ||
+        sigaction(SIGHUP, &shutdown_action, NULL)) {
+        cerr << "main(...): sigaction(...) failed." << endl;
         gracefull_exit(-EXIT_FAILURE);
     }
     
+    // not fatal, only for print_trigger_stats(), before setting up the desktop environment so all its messages get counted
+    if (setup_dbus_message_stats() != EXIT_SUCCESS) {
+        cerr << "main(...): setup_dbus_message_stats(...) failed." << endl;
+    }
+    
+    // not fatal, the touchpads get looked for again on first use
+    if (setup_touchpad_control() != EXIT_SUCCESS) {
+        cerr << "main(...): setup_touchpad_control(...) failed." << endl;
+    }
+    
     char *xdg_current_desktop = getenv("XDG_CURRENT_DESKTOP");
     if (!xdg_current_desktop) {
         cout << "Your desktop environment could not be determined." << endl;
@@ -119,16 +243,22 @@ int main() {
         gracefull_exit(SIGTERM);
     }
     
-    // start empty glib mainloop, required for glib signals to be catched
-    GMainLoop *app = g_main_loop_new(NULL, TRUE);
-    if (!app) {
-        cerr << "main(...): g_main_loop_new(...) failed." << endl;
-        gracefull_exit(-EXIT_FAILURE);
+    // not fatal, the touchpads just do not get checked for state drift then
+    if (setup_touchpad_audit() != EXIT_SUCCESS) {
+        cerr << "main(...): setup_touchpad_audit(...) failed." << endl;
+    }
+    
+#ifdef WITH_SWITCH_EVENTS
+    // not fatal, the touchpads just keep scanning with closed lid or in tablet mode then
+    if (setup_switch_events() != EXIT_SUCCESS) {
+        cerr << "main(...): setup_switch_events(...) failed." << endl;
     }
+#endif
     
+    // start glib mainloop, required for glib signals and the shutdown pipe to be handled
     g_main_loop_run(app);
-    // g_main_loop_run only returns on error
-    g_clear_object(&app);
-    cerr << "main(...): g_main_loop_run(...) failed." << endl;
-    gracefull_exit(-EXIT_FAILURE);
+    // g_main_loop_run only returns after shutdown_handler(...) quit it
+    g_main_loop_unref(app);
+    app = NULL;
+    gracefull_exit();
 }
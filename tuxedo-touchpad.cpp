@@ -0,0 +1,657 @@
+// Copyright (c) 2020 TUXEDO Computers GmbH <tux@tuxedocomputers.com>
+//
+// This file is part of TUXEDO Touchpad Switch.
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TUXEDO Touchpad Switch is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TUXEDO Touchpad Switch.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "tuxedo-touchpad-internal.h"
+
+#include <map>
+#include <string>
+#include <algorithm>
+#include <new>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/hidraw.h>
+
+#include <libudev.h>
+
+// the library never prints anything, errors are reported as negative errno values only, so that callers decide about
+// logging
+// no exception must leave the exported functions towards C callers, allocation failures of std::string and std::map
+// are reported as -ENOMEM and the touchpads get rediscovered on the next call
+
+struct touchpad_device {
+    std::string devnode;
+    int hidraw = -1;
+    int feature_report_id = -1;
+    // -1 if unknown, otherwise the state last written to/intended for the touchpad firmware
+    int applied_state = -1;
+    int desired_state = -1;
+    // built into the laptop, i.e. not attached via usb like the touchpad of a dock
+    bool builtin = false;
+    // kept off regardless of the desired state, see tuxedo_touchpad_set_builtin_forced_off(...)
+    bool forced_off = false;
+    // cleared if the firmware does not answer HIDIOCGFEATURE, so auditing does not retry it every time
+    bool readable = true;
+};
+
+// all found touchpads, keyed by seat and a stable device identity (the sysfs path of the i2c parent), so that the same
+// physical touchpad keeps its entry when its hidraw node gets recreated
+typedef std::map<std::pair<std::string, std::string>, touchpad_device> touchpad_device_map;
+
+struct tuxedo_touchpad {
+    std::string seat;
+    struct udev *udev_context = NULL;
+    struct udev_monitor *udev_monitor = NULL;
+    touchpad_device_map devices;
+    bool devices_stale = true;
+    unsigned long drift_count = 0;
+    // as last set via tuxedo_touchpad_set_state(...), inherited by touchpads showing up afterwards, e.g. on a dock
+    int desired_state = -1;
+    // as last set via tuxedo_touchpad_set_builtin_forced_off(...), inherited by built-in touchpads showing up afterwards
+    bool builtin_forced_off = false;
+};
+
+static std::string get_hidraw_seat(struct udev_device *hidraw_device) {
+    for (struct udev_device *it = hidraw_device; it; it = udev_device_get_parent(it)) {
+        const char *seat = udev_device_get_property_value(it, "ID_SEAT");
+        if (seat && seat[0]) {
+            return seat;
+        }
+    }
+    return "seat0";
+}
+
+// the transport device the hid device hangs off, e.g. the i2c client or the usb interface, unlike the hid device itself
+// it keeps its sysfs path when the touchpad gets rebound
+static std::string get_hidraw_identity(struct udev_device *hidraw_device) {
+    struct udev_device *parent = udev_device_get_parent_with_subsystem_devtype(hidraw_device, "hid", NULL);
+    if (parent && udev_device_get_parent(parent)) {
+        parent = udev_device_get_parent(parent);
+    }
+    if (!parent) {
+        parent = hidraw_device;
+    }
+    return udev_device_get_syspath(parent);
+}
+
+// "touchpad_device_map *found" gets amended with all hidraw devices, devnode, seat and identity set, which of them are
+// touchpads is decided by update_touchpad_devices(...) based on their report descriptor
+// returns a negative errno value on error or the number of found hidraw devices
+static int get_touchpad_hidraw_devices(struct udev *udev_context, touchpad_device_map *found) {
+    struct udev_enumerate *hidraw_devices = udev_enumerate_new(udev_context);
+    if (!hidraw_devices) {
+        return -ENOMEM;
+    }
+    
+    int result = udev_enumerate_add_match_subsystem(hidraw_devices, "hidraw");
+    if (result >= 0) {
+        result = udev_enumerate_scan_devices(hidraw_devices);
+    }
+    if (result >= 0) {
+        // an empty list is returned as NULL, meaning no hidraw devices at all
+        struct udev_list_entry *hidraw_device_entry;
+        udev_list_entry_foreach(hidraw_device_entry, udev_enumerate_get_list_entry(hidraw_devices)) {
+            // skipped if gone in the meantime
+            struct udev_device *hidraw_device = udev_device_new_from_syspath(udev_context, udev_list_entry_get_name(hidraw_device_entry));
+            if (hidraw_device) {
+                const char *devnode = udev_device_get_devnode(hidraw_device);
+                if (devnode) {
+                    touchpad_device device;
+                    device.devnode = devnode;
+                    device.builtin = !udev_device_get_parent_with_subsystem_devtype(hidraw_device, "usb", NULL);
+                    (*found)[std::make_pair(get_hidraw_seat(hidraw_device), get_hidraw_identity(hidraw_device))] = device;
+                }
+                
+                udev_device_unref(hidraw_device);
+            }
+        }
+        
+        result = found->size();
+    }
+    
+    udev_enumerate_unref(hidraw_devices);
+
+    return result;
+}
+
+// "int hidraw" must be an open file descriptor of a hidraw device
+// returns the report id of the selective reporting feature, -ENOENT if there is none or another negative errno value on error
+static int get_hidraw_surface_button_switch_report_id(int hidraw) {
+    struct hidraw_report_descriptor report_descriptor;
+
+    if (ioctl(hidraw, HIDIOCGRDESCSIZE, &report_descriptor.size) < 0) {
+        return -errno;
+    }
+
+    if (ioctl(hidraw, HIDIOCGRDESC, &report_descriptor) < 0) {
+        return -errno;
+    }
+
+    __u8 surface_button_switch_collection_identifier[] = {0x05, 0x0d, 0x09, 0x22, 0xa1, 0x00, 0x09, 0x57, 0x09, 0x58};
+    auto value_end = std::begin(report_descriptor.value) + report_descriptor.size;
+    auto it1 = std::search(std::begin(report_descriptor.value), value_end, std::begin(surface_button_switch_collection_identifier), std::end(surface_button_switch_collection_identifier));
+    for (auto it2 = it1; it2 != value_end; ++it2) {
+        if (*it2 == 0x85 && std::next(it2) != value_end) {
+            return *(std::next(it2));
+        }
+    }
+
+    return -ENOENT;
+}
+
+static void close_touchpad_device(touchpad_device *device) {
+    if (device->hidraw >= 0) {
+        close(device->hidraw);
+        device->hidraw = -1;
+    }
+}
+
+// rescans the touchpads, devices already known keep their desired state and, if their hidraw node did not change, their
+// open file descriptor, cached feature report id and applied state
+// returns a negative errno value on error or the number of usable touchpads
+static int update_touchpad_devices(struct tuxedo_touchpad *context) {
+    touchpad_device_map found;
+    int result = get_touchpad_hidraw_devices(context->udev_context, &found);
+    if (result < 0) {
+        return result;
+    }
+    
+    for (auto it = found.begin(); it != found.end(); ++it) {
+        if (it->first.first == context->seat) {
+            it->second.desired_state = context->desired_state;
+            it->second.forced_off = it->second.builtin && context->builtin_forced_off;
+        }
+    }
+    
+    for (auto it = context->devices.begin(); it != context->devices.end(); ++it) {
+        auto found_it = found.find(it->first);
+        if (found_it == found.end()) {
+            close_touchpad_device(&it->second);
+            continue;
+        }
+        found_it->second.desired_state = it->second.desired_state;
+        if (found_it->second.devnode == it->second.devnode && it->second.hidraw >= 0) {
+            found_it->second = it->second;
+        }
+        else {
+            close_touchpad_device(&it->second);
+        }
+    }
+    
+    for (auto it = found.begin(); it != found.end();) {
+        touchpad_device *device = &it->second;
+        if (device->hidraw < 0) {
+            // not an error, only the hidraw nodes made accessible by the udev rules can be opened by unprivileged users
+            device->hidraw = open(device->devnode.c_str(), O_WRONLY|O_NONBLOCK|O_CLOEXEC);
+            if (device->hidraw < 0) {
+                it = found.erase(it);
+                continue;
+            }
+            // every touchpad with the selective reporting feature, i.e. every Precision Touchpad, qualifies
+            device->feature_report_id = get_hidraw_surface_button_switch_report_id(device->hidraw);
+            if (device->feature_report_id < 0) {
+                close_touchpad_device(device);
+                it = found.erase(it);
+                continue;
+            }
+            device->applied_state = -1;
+        }
+        ++it;
+    }
+    
+    context->devices.swap(found);
+    context->devices_stale = false;
+    
+    return context->devices.size();
+}
+
+// returns the state the firmware of "touchpad_device *device" should be in, -1 if it has no desired state
+static int get_target_state(touchpad_device *device) {
+    if (device->desired_state < 0) {
+        return -1;
+    }
+    return device->forced_off ? 0 : device->desired_state;
+}
+
+// returns 0 or a negative errno value, on failure the touchpads get marked for rediscovery
+static int write_touchpad_state(struct tuxedo_touchpad *context, touchpad_device *device, int enabled) {
+    // To enable touchpad send "0x03" as feature report to the touchpad hid device. The feature report number can be gathered from the report descriptors.
+    // To disable it send "0x00".
+    // Reference: https://docs.microsoft.com/en-us/windows-hardware/design/component-guidelines/touchpad-configuration-collection#selective-reporting-feature-report
+    // Details:
+    // The two rightmost bits control the touchpad status
+    // In order, they are:
+    // 1. LED off + touchpad on/LED on + touchpad off
+    // 2. Clicks on/off
+    // So, the options are:
+    // 0x00 LED on, touchpad off, touchpad click off
+    // 0x01 LED on, touchpad off, touchpad click on
+    // 0x02 LED off, touchpad on, touchpad click off
+    // 0x03 LED off, touchpad on, touchpad click on
+    char buffer[2] = {static_cast<char>(device->feature_report_id), 0x00};
+    if (enabled) {
+        buffer[1] = 0x03;
+    }
+
+    if (ioctl(device->hidraw, HIDIOCSFEATURE(sizeof(buffer)/sizeof(buffer[0])), buffer) < 0) {
+        int result = -errno;
+        device->applied_state = -1;
+        context->devices_stale = true;
+        return result;
+    }
+    
+    device->applied_state = enabled;
+    return 0;
+}
+
+// returns the state currently reported by the touchpad firmware, 0 for disabled, 1 for enabled or a negative errno value on
+// error
+static int read_touchpad_state(struct tuxedo_touchpad *context, touchpad_device *device) {
+    // see write_touchpad_state(...) for the meaning of the bits
+    char buffer[2] = {static_cast<char>(device->feature_report_id), 0x00};
+
+    if (ioctl(device->hidraw, HIDIOCGFEATURE(sizeof(buffer)/sizeof(buffer[0])), buffer) < 0) {
+        int result = -errno;
+        if (result == -ENODEV) {
+            context->devices_stale = true;
+        }
+        else {
+            device->readable = false;
+        }
+        return result;
+    }
+
+    return (buffer[1] & 0x03) == 0x03 ? 1 : 0;
+}
+
+struct tuxedo_touchpad *tuxedo_touchpad_open(const char *seat) {
+    struct tuxedo_touchpad *context = new (std::nothrow) tuxedo_touchpad();
+    if (!context) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    
+    if (!seat) {
+        seat = getenv("XDG_SEAT");
+    }
+    if (!seat || !seat[0]) {
+        seat = "seat0";
+    }
+    try {
+        context->seat = seat;
+    }
+    catch (...) {
+        delete context;
+        errno = ENOMEM;
+        return NULL;
+    }
+    
+    int result = 0;
+    
+    context->udev_context = udev_new();
+    if (!context->udev_context) {
+        result = -ENOMEM;
+    }
+    
+    if (result >= 0) {
+        context->udev_monitor = udev_monitor_new_from_netlink(context->udev_context, "udev");
+        if (!context->udev_monitor) {
+            result = -ENOMEM;
+        }
+    }
+    
+    if (result >= 0) {
+        result = udev_monitor_filter_add_match_subsystem_devtype(context->udev_monitor, "hidraw", NULL);
+    }
+    if (result >= 0) {
+        result = udev_monitor_filter_add_match_subsystem_devtype(context->udev_monitor, "hid", NULL);
+    }
+    if (result >= 0) {
+        result = udev_monitor_enable_receiving(context->udev_monitor);
+    }
+    
+    if (result < 0) {
+        tuxedo_touchpad_close(context);
+        errno = -result;
+        return NULL;
+    }
+    
+    // errors are not fatal, the touchpad might just not be ready yet, the next access tries again
+    try {
+        update_touchpad_devices(context);
+    }
+    catch (...) {
+        context->devices_stale = true;
+    }
+    
+    return context;
+}
+
+void tuxedo_touchpad_close(struct tuxedo_touchpad *context) {
+    if (!context) {
+        return;
+    }
+    
+    for (auto it = context->devices.begin(); it != context->devices.end(); ++it) {
+        close_touchpad_device(&it->second);
+    }
+    if (context->udev_monitor) {
+        udev_monitor_unref(context->udev_monitor);
+    }
+    if (context->udev_context) {
+        udev_unref(context->udev_context);
+    }
+    
+    delete context;
+}
+
+int tuxedo_touchpad_set_state(struct tuxedo_touchpad *context, int enabled) {
+    try {
+        enabled = enabled ? 1 : 0;
+        
+        if (context->devices_stale) {
+            int result = update_touchpad_devices(context);
+            if (result < 0) {
+                return result;
+            }
+        }
+        
+        int result = 0;
+        int touchpad_count = 0;
+        context->desired_state = enabled;
+        
+        for (auto it = context->devices.begin(); it != context->devices.end(); ++it) {
+            if (it->first.first != context->seat) {
+                continue;
+            }
+            ++touchpad_count;
+            
+            touchpad_device *device = &it->second;
+            device->desired_state = enabled;
+            int target_state = get_target_state(device);
+            if (device->applied_state == target_state) {
+                continue;
+            }
+            
+            int write_result = write_touchpad_state(context, device, target_state);
+            if (write_result < 0 && result == 0) {
+                result = write_result;
+            }
+        }
+        
+        if (touchpad_count == 0) {
+            // maybe the touchpad was not ready yet, look again next time
+            context->devices_stale = true;
+            return -ENODEV;
+        }
+        
+        return result;
+    }
+    catch (...) {
+        context->devices_stale = true;
+        return -ENOMEM;
+    }
+}
+
+int tuxedo_touchpad_get_state(struct tuxedo_touchpad *context) {
+    try {
+        if (context->devices_stale) {
+            int result = update_touchpad_devices(context);
+            if (result < 0) {
+                return result;
+            }
+        }
+        
+        int result = -ENODEV;
+        
+        for (auto it = context->devices.begin(); it != context->devices.end(); ++it) {
+            if (it->first.first != context->seat) {
+                continue;
+            }
+            
+            touchpad_device *device = &it->second;
+            int state = device->applied_state;
+            if (device->readable) {
+                state = read_touchpad_state(context, device);
+                if (state < 0) {
+                    return state;
+                }
+            }
+            else if (state < 0) {
+                // the firmware does not answer and nothing was written so far
+                return -ENODATA;
+            }
+            
+            if (result != 0) {
+                result = state;
+            }
+        }
+        
+        return result;
+    }
+    catch (...) {
+        context->devices_stale = true;
+        return -ENOMEM;
+    }
+}
+
+int tuxedo_touchpad_restore(struct tuxedo_touchpad *context) {
+    try {
+        int result = 0;
+        
+        for (auto it = context->devices.begin(); it != context->devices.end(); ++it) {
+            touchpad_device *device = &it->second;
+            if (it->first.first != context->seat || device->hidraw < 0) {
+                continue;
+            }
+            
+            // written unconditionally, the firmware might have drifted since the last audit
+            int write_result = write_touchpad_state(context, device, 1);
+            if (write_result < 0 && result == 0) {
+                result = write_result;
+            }
+        }
+        
+        return result;
+    }
+    catch (...) {
+        context->devices_stale = true;
+        return -ENOMEM;
+    }
+}
+
+void tuxedo_touchpad_reset(struct tuxedo_touchpad *context) {
+    context->desired_state = -1;
+    for (auto it = context->devices.begin(); it != context->devices.end(); ++it) {
+        it->second.applied_state = -1;
+        it->second.desired_state = -1;
+    }
+}
+
+int tuxedo_touchpad_audit(struct tuxedo_touchpad *context) {
+    try {
+        if (context->devices_stale) {
+            int result = update_touchpad_devices(context);
+            if (result < 0) {
+                return result;
+            }
+        }
+        
+        int drifted = 0;
+        
+        for (auto it = context->devices.begin(); it != context->devices.end(); ++it) {
+            touchpad_device *device = &it->second;
+            int target_state = get_target_state(device);
+            if (it->first.first != context->seat || target_state < 0) {
+                continue;
+            }
+            
+            // a failed earlier write or a recreated hidraw node, which means the touchpad went through a reset and is back in
+            // its default state anyway, no drift as far as the firmware is concerned
+            // write errors get retried on the next audit
+            if (device->applied_state != target_state) {
+                write_touchpad_state(context, device, target_state);
+                continue;
+            }
+            
+            if (!device->readable) {
+                continue;
+            }
+            int state = read_touchpad_state(context, device);
+            if (state < 0 || state == target_state) {
+                continue;
+            }
+            
+            ++drifted;
+            ++context->drift_count;
+            write_touchpad_state(context, device, target_state);
+        }
+        
+        return drifted;
+    }
+    catch (...) {
+        context->devices_stale = true;
+        return -ENOMEM;
+    }
+}
+
+int tuxedo_touchpad_set_builtin_forced_off(struct tuxedo_touchpad *context, int forced_off) {
+    try {
+        if (context->devices_stale) {
+            int result = update_touchpad_devices(context);
+            if (result < 0) {
+                return result;
+            }
+        }
+        
+        int result = 0;
+        context->builtin_forced_off = forced_off;
+        
+        for (auto it = context->devices.begin(); it != context->devices.end(); ++it) {
+            touchpad_device *device = &it->second;
+            if (it->first.first != context->seat || !device->builtin) {
+                continue;
+            }
+            device->forced_off = forced_off;
+            
+            // touchpads without desired state are not ours to write to, the flag applies once they get one
+            int target_state = get_target_state(device);
+            if (target_state < 0 || device->applied_state == target_state) {
+                continue;
+            }
+            
+            int write_result = write_touchpad_state(context, device, target_state);
+            if (write_result < 0 && result == 0) {
+                result = write_result;
+            }
+        }
+        
+        return result;
+    }
+    catch (...) {
+        context->devices_stale = true;
+        return -ENOMEM;
+    }
+}
+
+void tuxedo_touchpad_take_restore_snapshot(struct tuxedo_touchpad *context, struct tuxedo_touchpad_restore_snapshot *snapshot) {
+    // a signal arriving meanwhile sees an empty snapshot rather than a half written one
+    snapshot->count = 0;
+    
+    int count = 0;
+    for (auto it = context->devices.begin(); it != context->devices.end() && count < TUXEDO_TOUCHPAD_RESTORE_SNAPSHOT_SIZE; ++it) {
+        const touchpad_device *device = &it->second;
+        if (it->first.first != context->seat || device->hidraw < 0) {
+            continue;
+        }
+        snapshot->hidraw[count] = device->hidraw;
+        snapshot->feature_report_id[count] = device->feature_report_id;
+        ++count;
+    }
+    
+    snapshot->count = count;
+}
+
+void tuxedo_touchpad_restore_from_snapshot(const struct tuxedo_touchpad_restore_snapshot *snapshot) {
+    for (int i = 0; i < snapshot->count; ++i) {
+        // see write_touchpad_state(...)
+        char buffer[2] = {static_cast<char>(snapshot->feature_report_id[i]), 0x03};
+        ioctl(snapshot->hidraw[i], HIDIOCSFEATURE(sizeof(buffer)/sizeof(buffer[0])), buffer);
+    }
+}
+
+int tuxedo_touchpad_get_managed_count(struct tuxedo_touchpad *context) {
+    int count = 0;
+    
+    for (auto it = context->devices.begin(); it != context->devices.end(); ++it) {
+        if (it->first.first == context->seat && it->second.desired_state >= 0) {
+            ++count;
+        }
+    }
+    
+    return count;
+}
+
+unsigned long tuxedo_touchpad_get_drift_count(struct tuxedo_touchpad *context) {
+    return context->drift_count;
+}
+
+int tuxedo_touchpad_get_fd(struct tuxedo_touchpad *context) {
+    return udev_monitor_get_fd(context->udev_monitor);
+}
+
+int tuxedo_touchpad_dispatch(struct tuxedo_touchpad *context) {
+    try {
+        int events = 0;
+        
+        struct udev_device *device;
+        while ((device = udev_monitor_receive_device(context->udev_monitor))) {
+            const char *syspath = udev_device_get_syspath(device);
+            const char *subsystem = udev_device_get_subsystem(device);
+            const char *action = udev_device_get_action(device);
+            if (syspath && subsystem && action) {
+                bool known = false;
+                for (auto it = context->devices.begin(); it != context->devices.end() && !known; ++it) {
+                    const std::string &identity = it->first.second;
+                    known = !strncmp(syspath, identity.c_str(), identity.size()) && (syspath[identity.size()] == '\0' || syspath[identity.size()] == '/');
+                }
+                
+                // any new hidraw node could be a touchpad, "remove" only matters for known ones, "bind" and "change" on the
+                // hid device of a known touchpad hint at a firmware reset
+                if (!strcmp(subsystem, "hidraw") && (!strcmp(action, "add") || (known && !strcmp(action, "remove")))) {
+                    context->devices_stale = true;
+                    events |= TUXEDO_TOUCHPAD_EVENT_DEVICES_CHANGED;
+                }
+                else if (known) {
+                    events |= TUXEDO_TOUCHPAD_EVENT_DEVICES_RESET;
+                }
+            }
+            udev_device_unref(device);
+        }
+        
+        return events;
+    }
+    catch (...) {
+        context->devices_stale = true;
+        return -ENOMEM;
+    }
+}
@@ -0,0 +1,85 @@
+// Copyright (c) 2020 TUXEDO Computers GmbH <tux@tuxedocomputers.com>
+//
+// This file is part of TUXEDO Touchpad Switch.
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TUXEDO Touchpad Switch is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TUXEDO Touchpad Switch.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+// C API of libtuxedo-touchpad, toggles the touchpads of TongFang/Uniwill laptops, and with it the touchpad-disabled-LED,
+// via the selective reporting HID feature report
+//
+// Every hidraw device the caller can open and whose report descriptor has the selective reporting feature is handled,
+// e.g. additional Precision Touchpads of a dock. For unprivileged callers res/99-tuxedo-touchpad-switch.rules makes the
+// built-in UNIW0001 touchpads accessible, other touchpads need a similar rule.
+//
+// The touchpads get discovered once when opening a context and afterwards only when udev reports changes, so toggling
+// repeatedly is cheap. A context must not be used from multiple threads at the same time. The library never prints
+// anything, errors are only reported via the return values.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TUXEDO_TOUCHPAD_EXPORT __attribute__((visibility("default")))
+
+// returned by tuxedo_touchpad_dispatch(...)
+// touchpads were added or removed
+#define TUXEDO_TOUCHPAD_EVENT_DEVICES_CHANGED 0x1
+// a touchpad was rebound or changed, its firmware might have fallen back to its default state
+#define TUXEDO_TOUCHPAD_EVENT_DEVICES_RESET 0x2
+
+struct tuxedo_touchpad;
+
+// "const char *seat" selects the seat whose touchpads get controlled, NULL selects the seat of the current session
+// ($XDG_SEAT, defaults to "seat0")
+// returns a new context or NULL on error with errno set
+TUXEDO_TOUCHPAD_EXPORT struct tuxedo_touchpad *tuxedo_touchpad_open(const char *seat);
+TUXEDO_TOUCHPAD_EXPORT void tuxedo_touchpad_close(struct tuxedo_touchpad *context);
+
+// "int enabled" set to 0 disables the touchpads, any other value enables them, only touchpads whose last applied state
+// differs get written to
+// returns 0, -ENODEV if no compatible touchpads were found or another negative errno value on error, on error the
+// activate/deactivate state of found touchpads is undefined
+TUXEDO_TOUCHPAD_EXPORT int tuxedo_touchpad_set_state(struct tuxedo_touchpad *context, int enabled);
+
+// reads the state back from the touchpad firmware
+// returns 1 if all touchpads are enabled, 0 if at least one is disabled or a negative errno value on error
+TUXEDO_TOUCHPAD_EXPORT int tuxedo_touchpad_get_state(struct tuxedo_touchpad *context);
+
+// enables all touchpads already opened by the context, without rediscovering them or consulting udev, for use on
+// shutdown paths where time is short
+// returns 0 or a negative errno value on error
+TUXEDO_TOUCHPAD_EXPORT int tuxedo_touchpad_restore(struct tuxedo_touchpad *context);
+
+// reads the state back from the firmware of all touchpads set via tuxedo_touchpad_set_state(...) and rewrites it on
+// mismatch, touchpads whose last write failed or that were rediscovered get the desired state written without reading back
+// returns the number of touchpads whose firmware disagreed, 0 meaning all are consistent, or a negative errno value on
+// error
+TUXEDO_TOUCHPAD_EXPORT int tuxedo_touchpad_audit(struct tuxedo_touchpad *context);
+
+// returns the number of drifted touchpads found by tuxedo_touchpad_audit(...) over the lifetime of the context
+TUXEDO_TOUCHPAD_EXPORT unsigned long tuxedo_touchpad_get_drift_count(struct tuxedo_touchpad *context);
+
+// returns a file descriptor that becomes readable when touchpads get added, removed or rebound, call
+// tuxedo_touchpad_dispatch(...) then, changes of the touchpad state by other processes are not reported
+TUXEDO_TOUCHPAD_EXPORT int tuxedo_touchpad_get_fd(struct tuxedo_touchpad *context);
+
+// processes all pending notifications without blocking
+// returns a combination of the TUXEDO_TOUCHPAD_EVENT_* flags, 0 meaning nothing relevant happened
+TUXEDO_TOUCHPAD_EXPORT int tuxedo_touchpad_dispatch(struct tuxedo_touchpad *context);
+
+#ifdef __cplusplus
+}
+#endif